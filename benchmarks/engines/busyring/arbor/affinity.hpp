@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <arbor/context.hpp>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#ifdef ARB_MPI_ENABLED
+#include <mpi.h>
+#endif
+
+// Binding of ranks to NUMA nodes, and a report of the cpus that each thread can run on.
+//
+// The cpus of NUMA nodes, and of threads, are read from sysfs and procfs, so these
+// are only available on Linux.
+
+// Parse a Linux cpu list, e.g. "0-3,8,10-11".
+std::vector<unsigned> parse_cpu_list(const std::string& list) {
+    std::vector<unsigned> cpus;
+    std::stringstream s(list);
+    std::string range;
+    while (std::getline(s, range, ',')) {
+        if (range.empty()) continue;
+        auto dash = range.find('-');
+        unsigned first = std::stoul(range.substr(0, dash));
+        unsigned last = dash==std::string::npos? first: std::stoul(range.substr(dash+1));
+        for (unsigned c=first; c<=last; ++c) cpus.push_back(c);
+    }
+    return cpus;
+}
+
+// Read the first line of a file, or an empty string if it can't be read.
+std::string read_line(const std::string& fname) {
+    std::ifstream f(fname);
+    std::string line;
+    std::getline(f, line);
+    return line;
+}
+
+// The cpus of NUMA node, or none if they are unknown.
+std::vector<unsigned> numa_node_cpus(unsigned node) {
+    return parse_cpu_list(read_line("/sys/devices/system/node/node"+std::to_string(node)+"/cpulist"));
+}
+
+// The number of NUMA nodes, or 0 if it is unknown.
+unsigned num_numa_nodes() {
+    return parse_cpu_list(read_line("/sys/devices/system/node/online")).size();
+}
+
+// Collective: the rank of this process among the ranks on the same host.
+unsigned local_rank() {
+#ifdef ARB_MPI_ENABLED
+    MPI_Comm local;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &local);
+    int rank;
+    MPI_Comm_rank(local, &rank);
+    MPI_Comm_free(&local);
+    return rank;
+#else
+    return 0;
+#endif
+}
+
+// Collective: bind this rank to the cpus of a NUMA node, with ranks_per_node
+// consecutive ranks on each host per node. The binding is inherited by the
+// threads that are started later, which includes the Arbor thread pool if this
+// is called before the context is made, so that their memory is allocated on
+// the node by first touch.
+// Returns the node, or -1 if the NUMA nodes are unknown or binding failed.
+int bind_to_numa_node(unsigned ranks_per_node) {
+    const unsigned lrank = local_rank();
+    const unsigned nnodes = num_numa_nodes();
+    if (!nnodes) return -1;
+    const unsigned node = (lrank/ranks_per_node)%nnodes;
+
+#ifdef __linux__
+    auto cpus = numa_node_cpus(node);
+    if (cpus.empty()) return -1;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto c: cpus) CPU_SET(c, &set);
+    if (sched_setaffinity(0, sizeof(set), &set)) return -1;
+    return node;
+#else
+    return -1;
+#endif
+}
+
+// Collective: bind each rank to a NUMA node with bind_to_numa_node, if ranks_per_node
+// is not zero, and warn if it fails.
+void bind_ranks_to_numa(unsigned ranks_per_node) {
+    if (!ranks_per_node) return;
+    if (bind_to_numa_node(ranks_per_node)<0) {
+        std::cerr << "Warning: unable to bind rank to a NUMA node\n";
+    }
+}
+
+// The cpus that a thread of a rank can run on.
+struct thread_affinity {
+    unsigned rank;
+    long tid;
+    std::string cpus;
+};
+
+// The affinity of every thread of this process, in order of thread id.
+std::vector<thread_affinity> local_affinity(unsigned rank) {
+    std::vector<thread_affinity> threads;
+    std::error_code ec;
+    for (auto& task: std::filesystem::directory_iterator("/proc/self/task", ec)) {
+        std::ifstream f(task.path()/"status");
+        std::string line;
+        while (std::getline(f, line)) {
+            if (line.rfind("Cpus_allowed_list:", 0)==0) {
+                std::stringstream s(line.substr(18));
+                thread_affinity t{rank, std::stol(task.path().filename().string()), ""};
+                s >> t.cpus;
+                threads.push_back(t);
+                break;
+            }
+        }
+    }
+    std::sort(threads.begin(), threads.end(), [](auto& l, auto& r) { return l.tid<r.tid; });
+    return threads;
+}
+
+// Collective: the affinity of every thread of every rank, which is valid on the root rank.
+std::vector<thread_affinity> gather_affinity(const arb::context& ctx) {
+    auto local = local_affinity(arb::rank(ctx));
+#ifdef ARB_MPI_ENABLED
+    // Gather the affinities as lines of text "rank tid cpus".
+    std::stringstream s;
+    for (auto& t: local) s << t.rank << ' ' << t.tid << ' ' << t.cpus << '\n';
+    auto text = s.str();
+
+    const unsigned nranks = arb::num_ranks(ctx);
+    int count = text.size();
+    std::vector<int> counts(nranks), displs(nranks);
+    MPI_Gather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    for (unsigned r=1; r<nranks; ++r) displs[r] = displs[r-1]+counts[r-1];
+    std::string all(displs.back()+counts.back(), '\0');
+    MPI_Gatherv(text.data(), count, MPI_CHAR, all.data(), counts.data(), displs.data(), MPI_CHAR, 0, MPI_COMM_WORLD);
+
+    std::vector<thread_affinity> threads;
+    std::stringstream in(all);
+    thread_affinity t;
+    while (in >> t.rank >> t.tid >> t.cpus) threads.push_back(t);
+    return threads;
+#else
+    return local;
+#endif
+}
+
+// Print one line for each thread: "affinity: rank <rank> thread <i> tid <tid> cpus <cpu list>",
+// where threads are numbered on each rank in order of thread id.
+void print_affinity(std::ostream& o, const std::vector<thread_affinity>& threads) {
+    unsigned i = 0;
+    for (auto it=threads.begin(); it!=threads.end(); ++it) {
+        i = it!=threads.begin() && std::prev(it)->rank==it->rank? i+1: 0;
+        o << "affinity: rank " << it->rank << " thread " << i << " tid " << it->tid << " cpus " << it->cpus << "\n";
+    }
+}
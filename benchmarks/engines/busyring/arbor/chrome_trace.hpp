@@ -0,0 +1,205 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include <arbor/context.hpp>
+#include <arbor/profile/profiler.hpp>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#ifdef ARB_MPI_ENABLED
+#include <mpi.h>
+#endif
+
+// A timeline of the metering phases of a run in the Chrome trace event format,
+// which can be viewed with chrome://tracing or https://ui.perfetto.dev.
+//
+// Each rank is a process with a "phases" track, with the wall time of each
+// metering phase, which are the only spans on the timeline. The cpu time that
+// each thread spent running in a phase, read from /proc/self/task/<tid>/schedstat,
+// is only known for the phase as a whole, so it is shown as a counter per thread
+// with the utilization of the thread over each phase, and is in the arguments of
+// the phase.
+//
+// With ARB_PROFILE_ENABLED, the time and count of each profiler region are in the
+// arguments of the last phase. The Arbor profiler only accumulates them over all
+// threads since it was initialized, so they are totals, not spans of any phase.
+class chrome_trace {
+public:
+    using clock = std::chrono::steady_clock;
+
+    // Start a new set of phases. Called after the meters are started, which
+    // synchronises the ranks, so that the timelines of the ranks line up.
+    void start() {
+        phases_.clear();
+        origin_ = clock::now();
+        last_ = 0;
+        last_cpu_ = thread_cpu_times();
+    }
+
+    // Record the phase called name, which ends now.
+    void checkpoint(const std::string& name) {
+        const double now = std::chrono::duration<double, std::micro>(clock::now()-origin_).count();
+        auto cpu = thread_cpu_times();
+        phase p{name, last_, now, {}};
+        for (auto& [tid, t]: cpu) {
+            auto it = last_cpu_.find(tid);
+            p.cpu[tid] = t - (it==last_cpu_.end()? 0: it->second);
+        }
+        phases_.push_back(std::move(p));
+        last_ = now;
+        last_cpu_ = std::move(cpu);
+    }
+
+    // Collective: write the trace of all ranks to fname on the root rank.
+    void write(const std::string& fname, const arb::context& ctx) const {
+        const unsigned rank = arb::rank(ctx);
+        auto events = local_events(rank);
+        std::string text;
+        for (auto& e: events) {
+            if (!text.empty()) text += ",\n";
+            text += e.dump();
+        }
+
+#ifdef ARB_MPI_ENABLED
+        const unsigned nranks = arb::num_ranks(ctx);
+        int count = text.size();
+        std::vector<int> counts(nranks), displs(nranks);
+        MPI_Gather(&count, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+        for (unsigned r=1; r<nranks; ++r) displs[r] = displs[r-1]+counts[r-1];
+        std::string all(rank==0? displs.back()+counts.back(): 0, '\0');
+        MPI_Gatherv(text.data(), count, MPI_CHAR, all.data(), counts.data(), displs.data(), MPI_CHAR, 0, MPI_COMM_WORLD);
+        if (rank) return;
+
+        std::vector<std::string> parts;
+        for (unsigned r=0; r<nranks; ++r) {
+            if (counts[r]) parts.push_back(all.substr(displs[r], counts[r]));
+        }
+#else
+        std::vector<std::string> parts = {text};
+#endif
+
+        std::ofstream f(fname);
+        f << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        for (std::size_t i=0; i<parts.size(); ++i) {
+            f << (i? ",\n": "") << parts[i];
+        }
+        f << "\n]}\n";
+    }
+
+private:
+    struct phase {
+        std::string name;
+        double begin, end;                  // [μs] since the start.
+        std::map<long, double> cpu;         // Cpu time of each thread [μs].
+    };
+
+    static constexpr long phases_tid = 0;
+
+    // The trace events of this rank. Threads are numbered in order of thread id,
+    // as in the affinity report.
+    std::vector<nlohmann::json> local_events(unsigned rank) const {
+        std::vector<nlohmann::json> events;
+        auto metadata = [&](const char* name, long tid, const std::string& value) {
+            events.push_back({{"ph", "M"}, {"name", name}, {"pid", rank}, {"tid", tid}, {"args", {{"name", value}}}});
+        };
+        auto counter = [&](const std::string& name, double ts, double value) {
+            events.push_back({{"ph", "C"}, {"name", name}, {"pid", rank}, {"ts", ts}, {"args", {{"utilization", value}}}});
+        };
+
+        metadata("process_name", phases_tid, "rank "+std::to_string(rank));
+        events.push_back({{"ph", "M"}, {"name", "process_sort_index"}, {"pid", rank}, {"args", {{"sort_index", rank}}}});
+        metadata("thread_name", phases_tid, "phases");
+
+        std::vector<long> tids;
+        for (auto& p: phases_) {
+            for (auto& c: p.cpu) tids.push_back(c.first);
+        }
+        std::sort(tids.begin(), tids.end());
+        tids.erase(std::unique(tids.begin(), tids.end()), tids.end());
+        std::map<long, std::string> thread_name;
+        for (std::size_t i=0; i<tids.size(); ++i) {
+            thread_name[tids[i]] = "thread "+std::to_string(i)+" (tid "+std::to_string(tids[i])+")";
+        }
+
+        for (auto& p: phases_) {
+            const double wall = p.end-p.begin;
+            nlohmann::json args = {{"wall-time", wall*1e-6}};
+            for (auto& [tid, cpu]: p.cpu) {
+                args["cpu-time"][thread_name[tid]] = cpu*1e-6;
+                counter(thread_name[tid], p.begin, wall>0? cpu/wall: 0);
+            }
+#ifdef ARB_PROFILE_ENABLED
+            if (&p==&phases_.back()) args["profiler"] = profiler_totals();
+#endif
+            events.push_back({{"ph", "X"}, {"name", p.name}, {"cat", "phase"}, {"pid", rank}, {"tid", phases_tid},
+                              {"ts", p.begin}, {"dur", wall}, {"args", std::move(args)}});
+        }
+        // End the counters with the last phase.
+        if (!phases_.empty()) {
+            for (auto& t: thread_name) counter(t.second, phases_.back().end, 0);
+        }
+        return events;
+    }
+
+#ifdef ARB_PROFILE_ENABLED
+    // The total time and count of each profiler region since the profiler was initialized.
+    static nlohmann::json profiler_totals() {
+        auto prof = arb::profile::profiler_summary();
+        nlohmann::json j = {{"threads", prof.num_threads}};
+        for (std::size_t i=0; i<prof.names.size(); ++i) {
+            j["regions"][prof.names[i]] = {{"total-time", prof.times[i]}, {"count", prof.counts[i]}};
+        }
+        return j;
+    }
+#endif
+
+    // The cpu time of every thread of this process [μs], from schedstat,
+    // or from the user and system time in stat with clock tick resolution.
+    static std::map<long, double> thread_cpu_times() {
+        std::map<long, double> times;
+        std::error_code ec;
+        for (auto& task: std::filesystem::directory_iterator("/proc/self/task", ec)) {
+            const long tid = std::stol(task.path().filename().string());
+            std::ifstream sched(task.path()/"schedstat");
+            double ns;
+            if (sched >> ns) {
+                times[tid] = ns*1e-3;
+                continue;
+            }
+
+#ifdef __linux__
+            std::ifstream stat(task.path()/"stat");
+            std::string line;
+            if (!std::getline(stat, line)) continue;
+            // Fields after the command, which is in parentheses: utime and stime are the 12th and 13th.
+            std::stringstream s(line.substr(line.rfind(')')+2));
+            std::string field;
+            double utime = 0, stime = 0;
+            for (int i=0; i<13 && s >> field; ++i) {
+                if (i==11) utime = std::stod(field);
+                if (i==12) stime = std::stod(field);
+            }
+            times[tid] = (utime+stime)*1e6/sysconf(_SC_CLK_TCK);
+#endif
+        }
+        return times;
+    }
+
+    clock::time_point origin_;
+    double last_ = 0;
+    std::map<long, double> last_cpu_;
+    std::vector<phase> phases_;
+};
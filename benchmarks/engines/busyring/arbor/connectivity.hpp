@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <arbor/common_types.hpp>
+#include <arbor/recipe.hpp>
+
+#include "parameters.hpp"
+#include "rng.hpp"
+
+// Connectivity families for the random connections of each cell, in addition to
+// the connection from the previous cell in its ring.
+//
+// As with the uniform random connections, connection i of cell gid depends
+// only on (gid, i), through block i of the connections stream of gid, so that
+// the connections of a cell don't depend on the decomposition.
+// Block 0, which is not used by the uniform random connections, holds the
+// number of connections of the power law family.
+
+const char* connectivity_name(connectivity_kind kind) {
+    switch (kind) {
+    case connectivity_kind::smallworld: return "smallworld";
+    case connectivity_kind::distance:   return "distance";
+    case connectivity_kind::powerlaw:   return "powerlaw";
+    default:                            return "random";
+    }
+}
+
+// The source and delay of a random connection.
+struct connection_source {
+    arb::cell_gid_type gid;
+    float delay;
+};
+
+// The number of random connections onto cell gid, when the mean is count.
+//
+// For the power law family this is drawn from a Pareto distribution with
+// P(k) ~ k^-exponent, with the lower bound chosen so that the mean is count,
+// and capped at 100 times the mean.
+unsigned num_random_connections(arb::cell_gid_type gid, unsigned count, const connectivity_parameters& p) {
+    if (p.kind!=connectivity_kind::powerlaw || count==0) return count;
+
+    const double a = p.exponent;
+    const double kmin = count*(a-2)/(a-1);
+    const double u = rng::uniform01(rng::block(gid, rng::connections, 0)[0]);
+    const double k = kmin*std::pow(1-u, -1/(a-1));
+    return unsigned(std::clamp(k, 1., 100.*count));
+}
+
+// Random connection i>0 of cell gid in a network of ncells cells with the
+// smallworld, distance or powerlaw connectivity.
+connection_source random_connection(arb::cell_gid_type gid, unsigned i, unsigned ncells, double min_delay, const connectivity_parameters& p) {
+    auto r = rng::block(gid, rng::connections, i);
+    const long n = ncells;
+    float delay = min_delay+2*min_delay*rng::uniform01(r[1]);
+    long src;
+
+    switch (p.kind) {
+    case connectivity_kind::smallworld:
+        // Watts-Strogatz: connection i is from the gid at offset -1, +1, -2, +2, ...
+        // on a ring lattice of all cells, unless it is rewired to a uniformly random source.
+        if (rng::uniform01(r[2])<p.rewire) {
+            src = rng::uniform_int(r[0], ncells-1);
+            if (src>=long(gid)) ++src;
+        }
+        else {
+            const long m = (i+1)/2;
+            src = ((long(gid) + (i%2? -m: m))%n + n)%n;
+        }
+        break;
+    case connectivity_kind::distance: {
+        // Cells are on a grid of width ceil(sqrt(ncells)), in row major order of gid,
+        // with periodic boundaries. The offset of the source is drawn from a 2D Gaussian
+        // with standard deviation sigma, and the delay grows with its length.
+        const long w = std::ceil(std::sqrt(double(ncells)));
+        const long h = (n+w-1)/w;
+        const double radius = p.sigma*std::sqrt(-2*std::log(1-rng::uniform01(r[2])));
+        const double theta = 2*M_PI*rng::uniform01(r[3]);
+        long dx = std::lround(radius*std::cos(theta));
+        long dy = std::lround(radius*std::sin(theta));
+        if (dx==0 && dy==0) dx = rng::uniform01(r[0])<0.5? -1: 1;
+
+        const long x = ((long(gid)%w + dx)%w + w)%w;
+        const long y = ((long(gid)/w + dy)%h + h)%h;
+        src = y*w + x;
+        // The last row of the grid may be incomplete.
+        if (src>=n) src -= w;
+
+        delay = min_delay+p.delay_per_unit*std::hypot(double(dx), double(dy));
+        break;
+    }
+    default:
+        // Uniformly random sources.
+        src = rng::uniform_int(r[0], ncells-1);
+        if (src>=long(gid)) ++src;
+        break;
+    }
+
+    src %= n;
+    if (src==long(gid)) src = (src+1)%n;
+    return {arb::cell_gid_type(src), delay};
+}
+
+// The connections onto cell gid of the busyring model with parameters p: one
+// connection with weight ring_weight from the previous cell in its ring, and
+// synapses-1 random connections with weight random_weight, from the detector
+// of the source to the synapse "p_syn" of the target.
+std::vector<arb::cell_connection> ring_connections(arb::cell_gid_type gid, const ring_params& p, float ring_weight) {
+    using arb::cell_gid_type;
+
+    const cell_gid_type ncells = p.num_cells;
+    const double min_delay = p.min_delay;
+    std::vector<arb::cell_connection> cons;
+
+    const auto ncons = p.cell.synapses;
+    cons.reserve(ncons);
+
+    const auto s = p.ring_size;
+    const auto group = gid/s;
+    const auto group_start = s*group;
+    const auto group_end = std::min(group_start+s, ncells);
+    cell_gid_type src = gid==group_start? group_end-1: gid-1;
+    cons.push_back(arb::cell_connection({src, "detector"}, {"p_syn"}, ring_weight, min_delay));
+
+    // Make fan_in-1 connections with weight random_weight, 0 by default.
+    // The source is randomly picked, with no self connections, from all cells
+    // or with one of the other connectivities above.
+    if (p.cell.rng==rng_kind::mt19937) {
+        // Used to pick source cell for a connection.
+        std::uniform_int_distribution<cell_gid_type> dist(0, ncells-2);
+        // Used to pick delay for a connection.
+        std::uniform_real_distribution<float> delay_dist(0, 2*min_delay);
+        auto src_gen = std::mt19937(gid);
+        for (unsigned i=1; i<ncons; ++i) {
+            src = dist(src_gen);
+            if (src==gid) ++src;
+            const float delay = min_delay+delay_dist(src_gen);
+            cons.push_back(
+                arb::cell_connection({src, "detector"}, {"p_syn"}, p.random_weight, delay));
+        }
+    }
+    else if (p.connectivity.kind!=connectivity_kind::random) {
+        const unsigned nrandom = num_random_connections(gid, ncons-1, p.connectivity);
+        cons.reserve(nrandom+1);
+        for (unsigned i=1; i<=nrandom; ++i) {
+            auto c = random_connection(gid, i, ncells, min_delay, p.connectivity);
+            cons.push_back(
+                arb::cell_connection({c.gid, "detector"}, {"p_syn"}, p.random_weight, c.delay));
+        }
+    }
+    else {
+        for (unsigned i=1; i<ncons; ++i) {
+            // Connection i depends only on (gid, i).
+            auto r = rng::block(gid, rng::connections, i);
+            if (p.source_locality>0 && rng::uniform01(r[2])<p.source_locality) {
+                // Pick the source from the window of gids centred on gid, with wrap around.
+                const auto w = std::min(p.source_window, ncells-1);
+                const long d = long(rng::uniform_int(r[0], w)) - long(w/2);
+                src = (long(gid) + ncells + (d>=0? d+1: d)) % ncells;
+            }
+            else {
+                src = rng::uniform_int(r[0], ncells-1);
+                if (src==gid) ++src;
+            }
+            const float delay = min_delay+2*min_delay*rng::uniform01(r[1]);
+            cons.push_back(
+                arb::cell_connection({src, "detector"}, {"p_syn"}, p.random_weight, delay));
+        }
+    }
+    return cons;
+}
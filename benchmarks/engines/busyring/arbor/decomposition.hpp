@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <numeric>
+#include <ostream>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include <arbor/context.hpp>
+#include <arbor/domain_decomposition.hpp>
+#include <arbor/load_balance.hpp>
+#include <arbor/recipe.hpp>
+
+#ifdef ARB_MPI_ENABLED
+#include <mpi.h>
+#endif
+
+#include "parameters.hpp"
+
+const char* decomposition_name(decomposition_kind kind) {
+    switch (kind) {
+    case decomposition_kind::weighted: return "weighted";
+    case decomposition_kind::ring:     return "ring";
+    default:                           return "default";
+    }
+}
+
+// The number of the nranks ranks of a context that each process stands for: 1, or
+// the number of ranks of a dry run, in which the cells of the other ranks are
+// copies of those of the one process.
+unsigned ranks_per_process(unsigned nranks) {
+    int nproc = 1;
+#ifdef ARB_MPI_ENABLED
+    MPI_Comm_size(MPI_COMM_WORLD, &nproc);
+#endif
+    return nranks/nproc;
+}
+
+// The range of gids [first, last) for which the statistics and costs of cells are
+// computed on rank: cells are split evenly over ranks, with the remainder on the last rank.
+std::pair<unsigned, unsigned> cell_block(unsigned ncells, unsigned rank, unsigned nranks) {
+    const unsigned cells_per_rank = ncells/nranks;
+    return {rank*cells_per_rank, rank==nranks-1? ncells: (rank+1)*cells_per_rank};
+}
+
+// Gather the costs of the cells in the block of each rank, so that every rank
+// has the cost of every cell.
+std::vector<double> gather_costs(const std::vector<double>& local, unsigned ncells, const arb::context& ctx) {
+#ifdef ARB_MPI_ENABLED
+    const unsigned nranks = arb::num_ranks(ctx);
+    std::vector<int> counts(nranks), displs(nranks);
+    for (unsigned r=0; r<nranks; ++r) {
+        auto b = cell_block(ncells, r, nranks);
+        displs[r] = b.first;
+        counts[r] = b.second-b.first;
+    }
+    std::vector<double> costs(ncells);
+    MPI_Allgatherv(local.data(), int(local.size()), MPI_DOUBLE,
+                   costs.data(), counts.data(), displs.data(), MPI_DOUBLE, MPI_COMM_WORLD);
+    return costs;
+#else
+    return local;
+#endif
+}
+
+// Greedy longest processing time first bin packing: each item, in order of
+// decreasing cost, goes in the bin with the lowest total cost so far.
+// Returns the items in each bin, in ascending order.
+std::vector<std::vector<arb::cell_gid_type>> pack_by_cost(const std::vector<arb::cell_gid_type>& items, const std::vector<double>& costs, unsigned nbins) {
+    std::vector<arb::cell_gid_type> order(items);
+    std::stable_sort(order.begin(), order.end(),
+        [&costs](auto l, auto r) { return costs[l]>costs[r]; });
+
+    using bin = std::pair<double, unsigned>; // (total cost, index)
+    std::priority_queue<bin, std::vector<bin>, std::greater<bin>> bins;
+    for (unsigned i=0; i<nbins; ++i) bins.push({0., i});
+
+    std::vector<std::vector<arb::cell_gid_type>> packed(nbins);
+    for (auto gid: order) {
+        auto b = bins.top();
+        bins.pop();
+        packed[b.second].push_back(gid);
+        bins.push({b.first+costs[gid], b.second});
+    }
+    for (auto& p: packed) std::sort(p.begin(), p.end());
+
+    return packed;
+}
+
+// Decomposition that balances the cost of cells, instead of their number, over
+// ranks, then over the cell groups on each rank.
+//
+// As in partition_load_balance, all cells on a rank go in one group if they are
+// to run on the GPU, unless a GPU group size is given.
+arb::domain_decomposition partition_by_cost(const arb::recipe& rec, const arb::context& ctx, const std::vector<double>& costs, const partition_parameters& p) {
+    const unsigned nranks = arb::num_ranks(ctx);
+    const unsigned rank = arb::rank(ctx);
+
+    std::vector<arb::cell_gid_type> all(costs.size());
+    std::iota(all.begin(), all.end(), 0);
+    auto local = std::move(pack_by_cost(all, costs, nranks)[rank]);
+
+    const bool gpu = arb::has_gpu(ctx) && p.prefer_gpu;
+    const unsigned group_size = gpu? (p.gpu_group_size? p.gpu_group_size: std::max<unsigned>(1, local.size())): p.cpu_group_size;
+    const unsigned ngroups = (local.size()+group_size-1)/group_size;
+
+    std::vector<arb::group_description> groups;
+    for (auto& gids: pack_by_cost(local, costs, ngroups)) {
+        groups.push_back({arb::cell_kind::cable, std::move(gids), gpu? arb::backend_kind::gpu: arb::backend_kind::multicore});
+    }
+
+    return arb::domain_decomposition(rec, ctx, groups);
+}
+
+// Decomposition that keeps every ring of ring_size consecutive gids on one rank,
+// so that only the random connections between rings can cross ranks.
+// Rings are assigned to ranks in contiguous blocks of equal number, and the
+// cells on each rank are split into groups of consecutive gids, all of kind.
+arb::domain_decomposition partition_by_ring(const arb::recipe& rec, const arb::context& ctx, unsigned ring_size, const partition_parameters& p,
+                                            arb::cell_kind kind = arb::cell_kind::cable) {
+    const unsigned nranks = arb::num_ranks(ctx);
+    const unsigned rank = arb::rank(ctx);
+    const unsigned ncells = rec.num_cells();
+    const unsigned nrings = (ncells+ring_size-1)/ring_size;
+
+    const unsigned first = std::min(ncells, unsigned(std::uint64_t(rank)*nrings/nranks)*ring_size);
+    const unsigned last = std::min(ncells, unsigned(std::uint64_t(rank+1)*nrings/nranks)*ring_size);
+
+    const bool gpu = arb::has_gpu(ctx) && p.prefer_gpu;
+    const unsigned group_size = gpu? (p.gpu_group_size? p.gpu_group_size: std::max(1u, last-first)): p.cpu_group_size;
+
+    std::vector<arb::group_description> groups;
+    for (unsigned b=first; b<last; b+=group_size) {
+        std::vector<arb::cell_gid_type> gids(std::min(group_size, last-b));
+        std::iota(gids.begin(), gids.end(), b);
+        groups.push_back({kind, std::move(gids), gpu? arb::backend_kind::gpu: arb::backend_kind::multicore});
+    }
+
+    return arb::domain_decomposition(rec, ctx, groups);
+}
+
+// The fraction of connections onto the cells of a decomposition with a source on
+// another rank: of all connections, and of the connections with non-zero weight,
+// which are the connections that carry the activity of the rings.
+struct cross_rank_connections {
+    double all = 0;
+    double weighted = 0;
+
+    // Collective.
+    cross_rank_connections(const arb::recipe& rec, const arb::domain_decomposition& d) {
+        // Counts of {all, all crossing ranks, weighted, weighted crossing ranks}.
+        std::vector<double> counts(4, 0.);
+        const int rank = d.domain_id();
+        for (auto& g: d.groups()) {
+            for (auto gid: g.gids) {
+                for (auto& c: rec.connections_on(gid)) {
+                    const bool cross = d.gid_domain(c.source.gid)!=rank;
+                    counts[0] += 1;
+                    counts[1] += cross;
+                    if (c.weight!=0) {
+                        counts[2] += 1;
+                        counts[3] += cross;
+                    }
+                }
+            }
+        }
+#ifdef ARB_MPI_ENABLED
+        MPI_Allreduce(MPI_IN_PLACE, counts.data(), 4, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+        all = counts[0]? counts[1]/counts[0]: 0;
+        weighted = counts[2]? counts[3]/counts[2]: 0;
+    }
+
+    friend std::ostream& operator<<(std::ostream& o, const cross_rank_connections& c) {
+        return o << "all " << c.all << " weighted " << c.weighted;
+    }
+};
+
+// The number of connections from each gid onto the cells of the local rank.
+std::vector<std::uint32_t> local_fanout(const arb::recipe& rec, const arb::domain_decomposition& d) {
+    std::vector<std::uint32_t> fanout(rec.num_cells(), 0);
+    for (auto& g: d.groups()) {
+        for (auto gid: g.gids) {
+            for (auto& c: rec.connections_on(gid)) ++fanout[c.source.gid];
+        }
+    }
+    return fanout;
+}
+
+// The imbalance of a decomposition: the ratio of the largest to the mean total
+// cost of cells over ranks, and over all cell groups.
+struct imbalance {
+    double ranks = 1;
+    double groups = 1;
+
+    // Collective. In a dry run every rank has the cost of the simulated one.
+    imbalance(const arb::domain_decomposition& d, const std::vector<double>& costs) {
+        double group_max = 0, rank_cost = 0;
+        for (auto& g: d.groups()) {
+            double c = 0;
+            for (auto gid: g.gids) c += costs[gid];
+            group_max = std::max(group_max, c);
+            rank_cost += c;
+        }
+
+        double rank_max = rank_cost, total = rank_cost;
+        unsigned long ngroups = d.num_groups();
+#ifdef ARB_MPI_ENABLED
+        MPI_Allreduce(MPI_IN_PLACE, &group_max, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+        MPI_Allreduce(MPI_IN_PLACE, &rank_max, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+        MPI_Allreduce(MPI_IN_PLACE, &total, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        MPI_Allreduce(MPI_IN_PLACE, &ngroups, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+#endif
+        const unsigned copies = ranks_per_process(d.num_domains());
+        total *= copies;
+        ngroups *= copies;
+        if (total>0) {
+            ranks = rank_max*d.num_domains()/total;
+            groups = group_max*ngroups/total;
+        }
+    }
+
+    friend std::ostream& operator<<(std::ostream& o, const imbalance& i) {
+        return o << "ranks " << i.ranks << " groups " << i.groups;
+    }
+};
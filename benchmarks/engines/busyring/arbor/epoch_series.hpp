@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include <arbor/context.hpp>
+#include <arbor/simulation.hpp>
+#include <arbor/spike.hpp>
+
+#ifdef ARB_MPI_ENABLED
+#include <mpi.h>
+#endif
+
+#include "decomposition.hpp"
+#include "parameters.hpp"
+
+// Wall time, spikes and events of each epoch of a run, recorded with the epoch
+// callback of the simulation.
+//
+// Spikes are counted in the global spike callback, which is called once per
+// epoch on every rank with the spikes exchanged in that epoch, and the events
+// are the events that those spikes generate for the local cells, counted with
+// the fan-out of each source onto the local cells (see fanout_events), which
+// doesn't include the events of the background input.
+//
+// The buffers are allocated for the expected number of epochs before the run, so
+// that recording an epoch doesn't allocate.
+class epoch_series {
+public:
+    using clock = std::chrono::steady_clock;
+
+    epoch_series(std::size_t expected_epochs) {
+        time_.reserve(expected_epochs);
+        wall_.reserve(expected_epochs);
+        spikes_.reserve(expected_epochs);
+        events_.reserve(expected_epochs);
+    }
+
+    // The number of epochs of a run of duration with minimum connection delay min_delay,
+    // for which the epoch is half of the delay.
+    static std::size_t expected_epochs(double duration, double min_delay) {
+        return std::size_t(std::ceil(2*duration/min_delay))+1;
+    }
+
+    // Called from the global spike callback with the number of spikes and their events.
+    void exchange(std::uint64_t spikes, std::uint64_t events) {
+        spike_count_ += spikes;
+        event_count_ += events;
+    }
+
+    // Called from the epoch callback with the time t at the end of an epoch.
+    void epoch(double t) {
+        // Ignore callbacks that don't end an epoch, such as one at the start of a run.
+        if (t<=last_t_) return;
+        auto now = clock::now();
+        time_.push_back(t);
+        wall_.push_back(std::chrono::duration<double>(now-last_).count());
+        spikes_.push_back(spike_count_);
+        events_.push_back(event_count_);
+        spike_count_ = event_count_ = 0;
+        last_ = now;
+        last_t_ = t;
+    }
+
+    void attach(arb::simulation& sim) {
+        sim.set_epoch_callback([this](double t, double) { epoch(t); });
+    }
+
+    // Start timing the first epoch.
+    void start() {
+        last_ = clock::now();
+        last_t_ = 0;
+    }
+
+    // The series of all ranks: the smallest, mean and largest wall time of any rank,
+    // the spikes exchanged, and the events summed over ranks in each epoch.
+    // In a dry run, the ranks that are not simulated have the events of the one that is.
+    struct series {
+        unsigned ranks = 1;
+        std::vector<double> time, wall_min, wall_mean, wall_max;
+        std::vector<std::uint64_t> spikes, events;
+
+        std::size_t size() const { return time.size(); }
+    };
+
+    // Collective: the series of all ranks, which is valid on the root rank.
+    // Spikes exchanged after the last epoch callback are added to the last epoch.
+    series reduce(const arb::context& ctx) const {
+        series s;
+        s.ranks = arb::num_ranks(ctx);
+        s.time = time_;
+        s.wall_min = s.wall_max = s.wall_mean = wall_;
+        s.spikes = spikes_;
+        s.events = events_;
+        if (!s.spikes.empty()) {
+            s.spikes.back() += spike_count_;
+            s.events.back() += event_count_;
+        }
+        const unsigned copies = ranks_per_process(s.ranks);
+#ifdef ARB_MPI_ENABLED
+        const int n = s.size();
+        MPI_Reduce(wall_.data(), s.wall_min.data(), n, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+        MPI_Reduce(wall_.data(), s.wall_max.data(), n, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        MPI_Reduce(wall_.data(), s.wall_mean.data(), n, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+        std::vector<std::uint64_t> events(s.events);
+        MPI_Reduce(events.data(), s.events.data(), n, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+        for (auto& w: s.wall_mean) w /= s.ranks/copies;
+#endif
+        for (auto& e: s.events) e *= copies;
+        return s;
+    }
+
+private:
+    std::uint64_t spike_count_ = 0;
+    std::uint64_t event_count_ = 0;
+
+    std::vector<double> time_;          // Simulation time at the end of each epoch [ms].
+    std::vector<double> wall_;          // Wall time of each epoch [s].
+    std::vector<std::uint64_t> spikes_; // Spikes exchanged in each epoch.
+    std::vector<std::uint64_t> events_; // Events generated for the local cells in each epoch.
+
+    clock::time_point last_;
+    double last_t_ = 0;
+};
+
+// The events that spikes generate for the local cells, where fanout[gid] is the
+// number of connections from gid onto local cells (see local_fanout).
+std::uint64_t fanout_events(const std::vector<std::uint32_t>& fanout, const std::vector<arb::spike>& spikes) {
+    std::uint64_t events = 0;
+    for (auto& s: spikes) events += fanout[s.source.gid];
+    return events;
+}
+
+// Percentiles of the epoch wall time of the slowest rank, which all other ranks wait
+// for, and of the skew, the difference between the slowest and fastest rank.
+struct epoch_summary {
+    std::size_t epochs = 0;
+    double p50 = 0, p90 = 0, p99 = 0, max = 0, mean = 0;
+    double skew_mean = 0, skew_max = 0;
+    double spikes_mean = 0, events_mean = 0;
+
+    epoch_summary(const epoch_series::series& s): epochs(s.size()) {
+        if (!epochs) return;
+
+        std::vector<double> sorted(s.wall_max);
+        std::sort(sorted.begin(), sorted.end());
+        // Nearest rank percentile.
+        auto percentile = [&sorted](double q) {
+            return sorted[std::max<std::size_t>(std::ceil(q*sorted.size()), 1)-1];
+        };
+        p50 = percentile(0.5);
+        p90 = percentile(0.9);
+        p99 = percentile(0.99);
+        max = sorted.back();
+
+        for (std::size_t i=0; i<epochs; ++i) {
+            const double skew = s.wall_max[i]-s.wall_min[i];
+            mean += s.wall_max[i];
+            skew_mean += skew;
+            skew_max = std::max(skew_max, skew);
+            spikes_mean += s.spikes[i];
+            events_mean += s.events[i];
+        }
+        mean /= epochs;
+        skew_mean /= epochs;
+        spikes_mean /= epochs;
+        events_mean /= epochs;
+    }
+
+    nlohmann::json to_json() const {
+        return {
+            {"epochs", epochs},
+            {"wall-time", {{"p50", p50}, {"p90", p90}, {"p99", p99}, {"max", max}, {"mean", mean}}},
+            {"skew", {{"mean", skew_mean}, {"max", skew_max}}},
+            {"spikes-per-epoch", spikes_mean},
+            {"events-per-epoch", events_mean}
+        };
+    }
+
+    friend std::ostream& operator<<(std::ostream& o, const epoch_summary& s) {
+        return o << "epochs: " << s.epochs << " epochs; "
+                 << "wall p50 " << s.p50 << " p90 " << s.p90 << " p99 " << s.p99 << " max " << s.max << " s; "
+                 << "skew mean " << s.skew_mean << " max " << s.skew_max << " s; "
+                 << "spikes-per-epoch " << s.spikes_mean << "; "
+                 << "events-per-epoch " << s.events_mean;
+    }
+};
+
+// File name extension for each epoch series format.
+std::string epoch_file_extension(epoch_format format) {
+    return format==epoch_format::binary? "bin": "csv";
+}
+
+// Writes the series with one line per epoch:
+//
+//   epoch,time,wall-min,wall-mean,wall-max,spikes,events
+void write_epochs_csv(const std::string& fname, const epoch_series::series& s) {
+    std::ofstream file(fname);
+    file << "epoch,time,wall-min,wall-mean,wall-max,spikes,events\n";
+    file << std::setprecision(9);
+    for (std::size_t i=0; i<s.size(); ++i) {
+        file << i << ',' << s.time[i] << ',' << s.wall_min[i] << ',' << s.wall_mean[i] << ','
+             << s.wall_max[i] << ',' << s.spikes[i] << ',' << s.events[i] << '\n';
+    }
+}
+
+// Writes the series as raw little-endian columns, with the header of the binary
+// trace format (see trace_output.hpp) and magic "NSEPOCH1". The columns are
+// time [ms], wall-min, wall-mean and wall-max [s] as float64, and spikes and
+// events as uint64.
+void write_epochs_binary(const std::string& fname, const epoch_series::series& s) {
+    std::ofstream file(fname, std::ios::out|std::ios::binary);
+
+    auto put = [&file](const auto& v) {
+        file.write(reinterpret_cast<const char*>(&v), sizeof(v));
+    };
+    auto put_str = [&file](const char* s, std::size_t width) {
+        std::vector<char> buf(width, 0);
+        std::strncpy(buf.data(), s, width);
+        file.write(buf.data(), width);
+    };
+    auto put_column = [&file](const auto& v) {
+        file.write(reinterpret_cast<const char*>(v.data()), v.size()*sizeof(v[0]));
+    };
+
+    file.write("NSEPOCH1", 8);
+    put(std::uint64_t(s.size()));
+    put(std::uint32_t(6));
+    put_str("time", 16);      put_str("ms", 8); put_str("float64", 8);
+    put_str("wall-min", 16);  put_str("s", 8);  put_str("float64", 8);
+    put_str("wall-mean", 16); put_str("s", 8);  put_str("float64", 8);
+    put_str("wall-max", 16);  put_str("s", 8);  put_str("float64", 8);
+    put_str("spikes", 16);    put_str("", 8);   put_str("uint64", 8);
+    put_str("events", 16);    put_str("", 8);   put_str("uint64", 8);
+    put_column(s.time);
+    put_column(s.wall_min);
+    put_column(s.wall_mean);
+    put_column(s.wall_max);
+    put_column(s.spikes);
+    put_column(s.events);
+}
+
+void write_epochs(const std::string& fname, epoch_format format, const epoch_series::series& s) {
+    if (format==epoch_format::binary) {
+        write_epochs_binary(fname, s);
+    }
+    else {
+        write_epochs_csv(fname, s);
+    }
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#ifdef ARB_MPI_ENABLED
+#include <mpi.h>
+#endif
+
+// Peak resident memory of each rank in each metering phase, from the high-water
+// mark of the resident set size, VmHWM in /proc/self/status.
+//
+// The high-water mark is reset at the start and at each checkpoint by writing 5
+// to /proc/self/clear_refs (Linux 4.0 and later), so that the peak of a phase
+// is the peak during that phase. Where it can't be reset, the peak of a phase is
+// the peak of the process up to the end of the phase, and the peaks are marked
+// as cumulative.
+class memory_hwm {
+public:
+    memory_hwm() {
+        resettable_ = reset();
+    }
+
+    bool available() const {
+        return read_hwm()>=0;
+    }
+
+    // True if the peak of each phase includes the phases before it.
+    bool cumulative() const {
+        return !resettable_;
+    }
+
+    // Start a new set of phases.
+    void start() {
+        phases_.clear();
+        resettable_ = reset();
+    }
+
+    // Record the peak since the last checkpoint as the phase called name.
+    void checkpoint(const std::string& name) {
+        phases_.push_back({name, read_hwm()});
+        resettable_ = reset() && resettable_;
+    }
+
+    // The peak of one phase in bytes: the smallest and largest of any rank, the sum
+    // over ranks, and the largest sum over the ranks on one host, which is an upper
+    // bound on the peak of the host because the ranks need not peak at the same time.
+    // Peaks are -1 if they are unavailable on any rank.
+    struct summary {
+        std::string name;
+        double min, max, sum, node_max;
+    };
+
+    // Collective: the summary of each phase, which is valid on the root rank.
+    std::vector<summary> reduce() const {
+        std::vector<summary> result;
+#ifdef ARB_MPI_ENABLED
+        MPI_Comm node;
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node);
+#endif
+        for (auto& p: phases_) {
+            summary s{p.name, p.peak, p.peak, p.peak, p.peak};
+#ifdef ARB_MPI_ENABLED
+            double node_sum;
+            MPI_Allreduce(&p.peak, &node_sum, 1, MPI_DOUBLE, MPI_SUM, node);
+            MPI_Reduce(&p.peak, &s.sum, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+            MPI_Reduce(&p.peak, &s.min, 1, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+            MPI_Reduce(&p.peak, &s.max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+            MPI_Reduce(&node_sum, &s.node_max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+#endif
+            if (s.min<0) s.max = s.sum = s.node_max = -1;
+            result.push_back(s);
+        }
+#ifdef ARB_MPI_ENABLED
+        MPI_Comm_free(&node);
+#endif
+        return result;
+    }
+
+    // Print the peaks of each phase in MB.
+    static void print(std::ostream& o, const std::vector<summary>& phases, bool cumulative) {
+        o << std::setw(24) << std::left << (cumulative? "memory-hwm(MB,cumul)": "memory-hwm(MB)") << std::right;
+        for (auto name: {"rank-min", "rank-max", "rank-sum", "node-max"}) o << std::setw(12) << name;
+        o << "\n";
+
+        for (auto& p: phases) {
+            o << std::setw(24) << std::left << "hwm-"+p.name << std::right;
+            for (auto x: {p.min, p.max, p.sum, p.node_max}) {
+                o << std::setw(12);
+                if (x<0) o << "-"; else o << std::fixed << std::setprecision(3) << x*1e-6;
+            }
+            o << std::defaultfloat << "\n";
+        }
+    }
+
+    // The peaks of each phase in bytes, with null if they are unavailable.
+    static nlohmann::json to_json(const std::vector<summary>& phases, bool cumulative) {
+        nlohmann::json j;
+        j["cumulative"] = cumulative;
+        auto& jp = j["phases"];
+        for (auto& p: phases) {
+            auto& phase = jp[p.name];
+            if (p.min<0) {
+                phase = nullptr;
+                continue;
+            }
+            phase["rank-min"] = p.min;
+            phase["rank-max"] = p.max;
+            phase["rank-sum"] = p.sum;
+            phase["node-max"] = p.node_max;
+        }
+        return j;
+    }
+
+private:
+    struct phase {
+        std::string name;
+        double peak;
+    };
+
+    // The high-water mark of the resident set size in bytes, or -1 if it is unavailable.
+    static double read_hwm() {
+        std::ifstream f("/proc/self/status");
+        std::string line;
+        while (std::getline(f, line)) {
+            if (line.rfind("VmHWM:", 0)==0) {
+                std::stringstream s(line.substr(6));
+                double kb;
+                if (s >> kb) return kb*1024;
+            }
+        }
+        return -1;
+    }
+
+    // Reset the high-water mark to the current resident set size.
+    static bool reset() {
+        std::ofstream f("/proc/self/clear_refs");
+        f << "5";
+        f.flush();
+        return f.good();
+    }
+
+    bool resettable_ = false;
+    std::vector<phase> phases_;
+};
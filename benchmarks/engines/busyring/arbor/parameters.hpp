@@ -1,12 +1,121 @@
+#pragma once
+
 #include <iostream>
 
 #include <array>
 #include <cmath>
 #include <fstream>
+#include <optional>
 #include <random>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <common/json_params.hpp>
 
+// Format of the benchmark report, in addition to the text printed to stdout.
+enum class report_format {
+    text,       // Only the text report.
+    json        // Also a json report, <name>_report.json, in the output path.
+};
+
+// Random number generator used to build morphologies and connectivity.
+enum class rng_kind {
+    philox,     // Stateless counter-based generator keyed on gid; see rng.hpp.
+    mt19937     // Reproduces the std::mt19937(gid) streams of earlier versions.
+};
+
+// Format of the spike output file.
+enum class spike_format {
+    gdf,        // Text, one "gid time" pair per line.
+    bin32,      // Binary records of (gid: uint32, time: float32), little-endian.
+    bin64,      // Binary records of (gid: uint32, time: float64), little-endian.
+    stats       // No spikes are stored: only online statistics are written.
+};
+
+// How the spikes of each rank are brought together for output.
+enum class spike_gather_kind {
+    root,       // Gathered to the root rank with the global spike callback.
+    rank_files, // Each rank writes its own spikes to a separate file.
+    mpi_io      // Each rank writes its own spikes to one file with collective MPI-IO.
+};
+
+// Format of the voltage trace output file.
+enum class trace_format {
+    json,       // Human readable, for small runs.
+    binary,     // Raw little-endian columns with a small header; see trace_output.hpp.
+    netcdf      // NetCDF, as used by the validation tests.
+};
+
+// Format of the time series of the wall time, spikes and events of each epoch.
+enum class epoch_format {
+    none,       // No time series is recorded.
+    csv,        // Text, one line per epoch.
+    binary      // Raw little-endian columns with a small header; see epoch_series.hpp.
+};
+
+// How the cells to sample are chosen.
+enum class sample_selection {
+    stride,     // Every stride'th cell, starting with gid 0.
+    random,     // A random subset with a given fraction of the cells.
+    list        // An explicit list of gids.
+};
+
+// Parameters of voltage sampling at the soma, used when record_voltage is set.
+struct sampling_parameters {
+    sample_selection selection = sample_selection::list;
+    unsigned stride = 1;
+    double fraction = 0.01;
+    std::vector<unsigned> gids = {0};
+    double interval = 0.1;              // Sampling interval [ms].
+};
+
+// How cells are distributed over ranks and cell groups.
+enum class decomposition_kind {
+    load_balance,   // partition_load_balance: equal numbers of cells.
+    weighted,       // Equal total cost, the number of CVs, of cells; see decomposition.hpp.
+    ring            // Whole rings on each rank; see decomposition.hpp.
+};
+
+// The decomposition, and the hints for the partition of cells into cell groups.
+struct partition_parameters {
+    decomposition_kind kind = decomposition_kind::load_balance;
+    unsigned cpu_group_size = 1;        // Cells per group on the CPU.
+    unsigned gpu_group_size = 0;        // Cells per group on the GPU, 0 for as many as possible.
+    bool prefer_gpu = true;             // Use the GPU if available.
+};
+
+// The connectivity of the random connections of each cell; see connectivity.hpp.
+enum class connectivity_kind {
+    random,     // Uniformly random sources, as in the ring and kway models.
+    smallworld, // Nearest gids on a ring lattice, each rewired to a random source with probability rewire.
+    distance,   // Cells on a 2D grid, with Gaussian distance-dependent sources and delays.
+    powerlaw    // Uniformly random sources, with a power law distribution of connections per cell.
+};
+
+struct connectivity_parameters {
+    connectivity_kind kind = connectivity_kind::random;
+    double rewire = 0.1;                // smallworld: probability that a connection is rewired.
+    double sigma = 4;                   // distance: standard deviation of the source offset [grid spacing].
+    double delay_per_unit = 0.5;        // distance: delay added per grid spacing [ms].
+    double exponent = 2.5;              // powerlaw: exponent of the distribution of connections per cell.
+};
+
+// Binding of ranks and threads to cpus. All runs share one context, so the binding
+// of the first run applies to all of them.
+struct binding_parameters {
+    bool bind_threads = false;          // Bind each thread of the Arbor thread pool to a core.
+    bool bind_procs = false;            // Bind each rank to a disjoint set of cores.
+    unsigned ranks_per_numa = 0;        // Bind ranks to NUMA nodes, with this many on each node; 0 for none.
+};
+
+// Poisson background input, which drives activity in addition to the rings.
+struct background_parameters {
+    double rate = 0;                    // Rate of input events to each target cell [Hz], 0 for none.
+    float weight = 0.01;                // Weight of the input events [μS].
+    unsigned targets = 0;               // Number of cells that receive input, 0 for all cells.
+};
+
 // Parameters used to generate the random cell morphologies.
 struct cell_parameters {
     cell_parameters() = default;
@@ -26,6 +135,16 @@ struct cell_parameters {
 
     // The number of synapses per cell.
     unsigned synapses = 1;
+
+    // Build the label dictionary and decor once, and share them between all cells.
+    bool prototype_cache = true;
+
+    // When non-zero, and the prototype cache is enabled, only this many distinct
+    // random morphologies are generated, and cell gid uses morphology gid%unique_morphologies.
+    unsigned unique_morphologies = 0;
+
+    // Generator of the random branching and random connections.
+    rng_kind rng = rng_kind::philox;
 };
 
 struct ring_params {
@@ -37,38 +156,178 @@ struct ring_params {
     double min_delay = 10;
     double duration = 100;
     double dt = 0.025;
+
+    // The simulation is run warmup times, then timed over repetitions runs.
+    // Between runs it is either reset, or rebuilt from scratch.
+    unsigned warmup = 0;
+    unsigned repetitions = 1;
+    bool rebuild = false;
+
+    // Report hardware performance counters for each phase (Linux only).
+    bool perf_counters = false;
+
+    binding_parameters binding;
+
+    // Emulate this many ranks with one process, or 0 to run on the ranks of MPI. The
+    // process simulates the cells of the first rank, and the cells and spikes of the
+    // other ranks are copies of them. As with the binding, all runs share the value
+    // of the first run, see share_dry_run.
+    unsigned dry_run_ranks = 0;
+
+    // Record the wall time, spikes and events of each epoch of the last run.
+    epoch_format epoch_series = epoch_format::none;
+
+    // Record the spikes generated and received by each rank in each epoch of the last run.
+    bool spike_exchange = false;
+
+    // Report the fraction of connections that cross ranks, which takes another pass
+    // over the connections of every local cell after the timed phases.
+    bool cross_rank_stats = false;
+
     bool record_voltage = false;
+    trace_format trace_output = trace_format::json;
+    sampling_parameters sampling;
     std::string odir = ".";
+    report_format report = report_format::text;
+
+    // Write a timeline of the phases in the Chrome trace event format; see chrome_trace.hpp.
+    bool trace_out = false;
+
+    // Spikes are written to file by a background thread while the simulation runs.
+    spike_format spike_output = spike_format::gdf;
+    spike_gather_kind spike_gather = spike_gather_kind::root;
+    bool spike_sort = false;            // Write spikes in order of time.
+    unsigned spike_buffer = 1u<<16;     // Spikes buffered before a write is issued.
+
     cell_parameters cell;
+    partition_parameters partition;
+
+    connectivity_parameters connectivity;
+
+    // The fraction of the random connections of each cell whose source is picked from
+    // the source_window nearest gids, instead of from all cells.
+    double source_locality = 0;
+    unsigned source_window = 100;
+
+    // The weight of the random connections, which by default don't affect the activity.
+    float random_weight = 0;
+    background_parameters background;
 };
 
-ring_params read_options(int argc, char** argv) {
-    const char* usage = "Usage:  arbor-busyring [params [opath]]\n\n"
-                        "Driver for the Arbor busyring benchmark\n\n"
-                        "Options:\n"
-                        "   params: JSON file with model parameters.\n"
-                        "   opath: output path.\n";
-    using sup::param_from_json;
+// Search a json object for a string parameter, and map it to one of a set of named values.
+template <typename T>
+void enum_from_json(T& x, const char* name, const std::vector<std::pair<std::string, T>>& values, nlohmann::json& j) {
+    std::string key;
+    if (auto o = sup::find_and_remove_json<std::string>(name, j)) {
+        key = *o;
+    }
+    else {
+        return;
+    }
 
-    ring_params params;
-    if (argc<2) {
-        return params;
+    std::string valid;
+    for (auto& v: values) {
+        if (v.first==key) {
+            x = v.second;
+            return;
+        }
+        valid += (valid.empty()? "": ", ") + v.first;
     }
-    if (argc>3) {
-        std::cout << usage << std::endl;
-        throw std::runtime_error("More than two command line options is not permitted.");
+    throw std::runtime_error("Unknown "+std::string(name)+" \""+key+"\": expected one of "+valid+".");
+}
+
+// Expand the sweeps in a json configuration into a list of configurations.
+//
+// A parameter is swept if its value is an object with one of the forms:
+//   {"values": [v0, v1, ...]}      each of the values.
+//   {"range": [first, last]}       integers first, first+1, ..., last.
+//   {"range": [first, last, step]} integers first, first+step, ..., up to last.
+//   {"pow2": [first, last]}        powers of two 2^first, ..., 2^last.
+// The configurations are the cartesian product of all swept parameters, and
+// the value of each swept parameter is appended to the name of the run.
+std::vector<nlohmann::json> expand_sweeps(const nlohmann::json& config) {
+    std::vector<nlohmann::json> configs = {config};
+
+    for (auto it=config.begin(); it!=config.end(); ++it) {
+        auto& spec = it.value();
+        if (!spec.is_object()) continue;
+        if (spec.size()!=1) {
+            throw std::runtime_error("sweep of parameter \""+it.key()+"\" must have exactly one of values, range or pow2.");
+        }
+
+        std::vector<nlohmann::json> values;
+        if (auto v = spec.find("values"); v!=spec.end()) {
+            values = v->get<std::vector<nlohmann::json>>();
+        }
+        else if (auto v = spec.find("range"); v!=spec.end()) {
+            auto r = v->get<std::vector<long long>>();
+            if (r.size()<2 || r.size()>3 || (r.size()==3 && r[2]<=0)) {
+                throw std::runtime_error("sweep range of parameter \""+it.key()+"\" must be [first, last] or [first, last, step>0].");
+            }
+            for (auto x=r[0]; x<=r[1]; x+=(r.size()==3? r[2]: 1)) values.push_back(x);
+        }
+        else if (auto v = spec.find("pow2"); v!=spec.end()) {
+            auto r = v->get<std::vector<unsigned>>();
+            if (r.size()!=2 || r[1]>=64) {
+                throw std::runtime_error("sweep pow2 of parameter \""+it.key()+"\" must be [first, last] with last<64.");
+            }
+            for (auto x=r[0]; x<=r[1]; ++x) values.push_back(1ull<<x);
+        }
+        else {
+            throw std::runtime_error("unknown sweep \""+spec.begin().key()+"\" of parameter \""+it.key()+"\".");
+        }
+
+        std::vector<nlohmann::json> expanded;
+        for (auto& c: configs) {
+            for (auto& v: values) {
+                auto e = c;
+                e[it.key()] = v;
+                auto name = e.find("name")!=e.end()? e["name"].get<std::string>(): std::string("default");
+                e["name"] = name + "_" + it.key() + "-" + (v.is_string()? v.get<std::string>(): v.dump());
+                expanded.push_back(std::move(e));
+            }
+        }
+        configs = std::move(expanded);
     }
 
-    // Assume that the first argument is a json parameter file
-    std::string fname = argv[1];
-    std::ifstream f(fname);
+    return configs;
+}
 
-    if (!f.good()) {
-        throw std::runtime_error("Unable to open input parameter file: "+fname);
+void check_dry_run(const ring_params& params) {
+    if (params.dry_run_ranks && params.partition.kind!=decomposition_kind::load_balance) {
+        throw std::runtime_error("dry-run-ranks requires decomposition \"default\".");
+    }
+}
+
+// All runs share one dry run context, for the dry run ranks and the cells per rank
+// of the first run. A later run may leave dry-run-ranks unset, but not set it to
+// another value. The cells of every run are rounded up to a multiple of the ranks,
+// and must then be the same for all runs.
+void share_dry_run(std::vector<ring_params>& runs) {
+    const auto& first = runs.front();
+    const auto nranks = first.dry_run_ranks;
+    for (auto& params: runs) {
+        if (params.dry_run_ranks && params.dry_run_ranks!=nranks) {
+            throw std::runtime_error("all runs must have the dry-run-ranks of the first run, or leave it unset.");
+        }
     }
+    if (!nranks) return;
 
-    nlohmann::json json;
-    json << f;
+    const auto ncells = (first.num_cells+nranks-1)/nranks*nranks;
+    for (auto& params: runs) {
+        params.dry_run_ranks = nranks;
+        params.num_cells = (params.num_cells+nranks-1)/nranks*nranks;
+        if (params.num_cells!=ncells) {
+            throw std::runtime_error("all runs of a dry run must have the same num-cells, rounded up to a multiple of dry-run-ranks.");
+        }
+        check_dry_run(params);
+    }
+}
+
+ring_params params_from_json(nlohmann::json json) {
+    using sup::param_from_json;
+
+    ring_params params;
 
     param_from_json(params.name, "name", json);
     param_from_json(params.num_cells, "num-cells", json);
@@ -76,13 +335,104 @@ ring_params read_options(int argc, char** argv) {
     param_from_json(params.duration, "duration", json);
     param_from_json(params.dt, "dt", json);
     param_from_json(params.min_delay, "min-delay", json);
+    param_from_json(params.warmup, "warmup", json);
+    param_from_json(params.repetitions, "repetitions", json);
+    param_from_json(params.rebuild, "rebuild", json);
+    if (params.repetitions<1) {
+        throw std::runtime_error("repetitions must be at least 1.");
+    }
+    enum_from_json(params.partition.kind, "decomposition",
+            {{"default", decomposition_kind::load_balance}, {"weighted", decomposition_kind::weighted},
+             {"ring", decomposition_kind::ring}}, json);
+    param_from_json(params.partition.cpu_group_size, "cpu-group-size", json);
+    param_from_json(params.partition.gpu_group_size, "gpu-group-size", json);
+    param_from_json(params.partition.prefer_gpu, "prefer-gpu", json);
+    if (params.partition.cpu_group_size<1) {
+        throw std::runtime_error("cpu-group-size must be at least 1.");
+    }
+    enum_from_json(params.connectivity.kind, "connectivity",
+            {{"random", connectivity_kind::random}, {"smallworld", connectivity_kind::smallworld},
+             {"distance", connectivity_kind::distance}, {"powerlaw", connectivity_kind::powerlaw}}, json);
+    param_from_json(params.connectivity.rewire, "rewire-prob", json);
+    param_from_json(params.connectivity.sigma, "distance-sigma", json);
+    param_from_json(params.connectivity.delay_per_unit, "distance-delay", json);
+    param_from_json(params.connectivity.exponent, "powerlaw-exponent", json);
+    if (params.connectivity.rewire<0 || params.connectivity.rewire>1) {
+        throw std::runtime_error("rewire-prob must be in [0, 1].");
+    }
+    if (params.connectivity.sigma<=0 || params.connectivity.delay_per_unit<0) {
+        throw std::runtime_error("distance-sigma must be positive, and distance-delay non-negative.");
+    }
+    if (params.connectivity.exponent<=2) {
+        throw std::runtime_error("powerlaw-exponent must be greater than 2.");
+    }
+    param_from_json(params.source_locality, "source-locality", json);
+    param_from_json(params.source_window, "source-window", json);
+    if (params.source_locality<0 || params.source_locality>1) {
+        throw std::runtime_error("source-locality must be in [0, 1].");
+    }
+    param_from_json(params.random_weight, "random-weight", json);
+    param_from_json(params.background.rate, "background-rate", json);
+    param_from_json(params.background.weight, "background-weight", json);
+    param_from_json(params.background.targets, "background-targets", json);
+    param_from_json(params.perf_counters, "perf-counters", json);
+    enum_from_json(params.epoch_series, "epoch-series",
+            {{"none", epoch_format::none}, {"csv", epoch_format::csv}, {"binary", epoch_format::binary}}, json);
+    param_from_json(params.spike_exchange, "spike-exchange", json);
+    param_from_json(params.cross_rank_stats, "cross-rank-stats", json);
+    param_from_json(params.dry_run_ranks, "dry-run-ranks", json);
+    check_dry_run(params);
+    param_from_json(params.binding.bind_threads, "bind-threads", json);
+    param_from_json(params.binding.bind_procs, "bind-procs", json);
+    param_from_json(params.binding.ranks_per_numa, "ranks-per-numa", json);
     param_from_json(params.record_voltage, "record", json);
+    enum_from_json(params.trace_output, "trace-format",
+            {{"json", trace_format::json}, {"binary", trace_format::binary}, {"netcdf", trace_format::netcdf}}, json);
+#ifndef BUSYRING_WITH_NETCDF
+    if (params.trace_output==trace_format::netcdf) {
+        throw std::runtime_error("trace-format \"netcdf\" requires busyring to be built with NetCDF.");
+    }
+#endif
+    enum_from_json(params.sampling.selection, "sample-selection",
+            {{"stride", sample_selection::stride}, {"random", sample_selection::random}, {"list", sample_selection::list}}, json);
+    param_from_json(params.sampling.stride, "sample-stride", json);
+    param_from_json(params.sampling.fraction, "sample-fraction", json);
+    param_from_json(params.sampling.gids, "sample-gids", json);
+    param_from_json(params.sampling.interval, "sample-interval", json);
     param_from_json(params.cell.complex_cell, "complex", json);
     param_from_json(params.cell.max_depth, "depth", json);
     param_from_json(params.cell.branch_probs, "branch-probs", json);
     param_from_json(params.cell.compartments, "compartments", json);
     param_from_json(params.cell.lengths, "lengths", json);
     param_from_json(params.cell.synapses, "synapses", json);
+    param_from_json(params.cell.prototype_cache, "prototype-cache", json);
+    param_from_json(params.cell.unique_morphologies, "unique-morphologies", json);
+    if (params.cell.unique_morphologies && !params.cell.prototype_cache) {
+        throw std::runtime_error("unique-morphologies requires prototype-cache.");
+    }
+    enum_from_json(params.cell.rng, "rng",
+            {{"philox", rng_kind::philox}, {"mt19937", rng_kind::mt19937}}, json);
+    if (params.cell.rng==rng_kind::mt19937 && params.source_locality>0) {
+        throw std::runtime_error("source-locality requires rng \"philox\".");
+    }
+    if (params.cell.rng==rng_kind::mt19937 && params.connectivity.kind!=connectivity_kind::random) {
+        throw std::runtime_error("connectivity other than \"random\" requires rng \"philox\".");
+    }
+    if (params.source_locality>0 && params.connectivity.kind!=connectivity_kind::random) {
+        throw std::runtime_error("source-locality requires connectivity \"random\".");
+    }
+    enum_from_json(params.spike_output, "spike-output",
+            {{"gdf", spike_format::gdf}, {"bin32", spike_format::bin32}, {"bin64", spike_format::bin64},
+             {"stats", spike_format::stats}}, json);
+    enum_from_json(params.spike_gather, "spike-gather",
+            {{"root", spike_gather_kind::root}, {"rank-files", spike_gather_kind::rank_files}, {"mpi-io", spike_gather_kind::mpi_io}}, json);
+#ifndef ARB_MPI_ENABLED
+    if (params.spike_gather==spike_gather_kind::mpi_io) {
+        throw std::runtime_error("spike-gather \"mpi-io\" requires Arbor to be built with MPI.");
+    }
+#endif
+    param_from_json(params.spike_sort, "spike-sort", json);
+    param_from_json(params.spike_buffer, "spike-buffer", json);
 
     if (!json.empty()) {
         for (auto it=json.begin(); it!=json.end(); ++it) {
@@ -91,10 +441,134 @@ ring_params read_options(int argc, char** argv) {
         std::cout << "\n";
     }
 
+    return params;
+}
+
+// The command line of a benchmark driver: the json configuration of each run,
+// the report format, and the output path, or empty if none was given.
+struct command_line {
+    std::vector<nlohmann::json> configs;
+    report_format report = report_format::text;
+    bool trace_out = false;
+    std::string odir;
+
+    // Binding options, which override those of the configurations.
+    std::optional<bool> bind_threads;
+    std::optional<bool> bind_procs;
+    std::optional<unsigned> ranks_per_numa;
+
+    void apply(binding_parameters& b) const {
+        if (bind_threads) b.bind_threads = *bind_threads;
+        if (bind_procs) b.bind_procs = *bind_procs;
+        if (ranks_per_numa) b.ranks_per_numa = *ranks_per_numa;
+        if (b.bind_procs && b.ranks_per_numa) {
+            throw std::runtime_error("bind-procs and ranks-per-numa can't be used together.");
+        }
+    }
+};
+
+// Parse the command line "[--report=text|json] [--trace-out] [--bind-threads] [--bind-procs]
+// [--ranks-per-numa=N] [params [opath]]".
+//
+// The parameter file holds either one configuration, or a list of configurations,
+// each of which can contain sweeps over parameters (see expand_sweeps).
+// Without a parameter file there is one run, with an empty configuration.
+command_line read_command_line(int argc, char** argv, const char* usage) {
+    command_line cl;
+    std::vector<std::string> args;
+    for (int i=1; i<argc; ++i) {
+        std::string arg = argv[i];
+        if (arg=="--report=text") {
+            cl.report = report_format::text;
+        }
+        else if (arg=="--report=json") {
+            cl.report = report_format::json;
+        }
+        else if (arg=="--trace-out") {
+            cl.trace_out = true;
+        }
+        else if (arg=="--bind-threads") {
+            cl.bind_threads = true;
+        }
+        else if (arg=="--bind-procs") {
+            cl.bind_procs = true;
+        }
+        else if (arg.rfind("--ranks-per-numa=", 0)==0) {
+            cl.ranks_per_numa = std::stoul(arg.substr(17));
+        }
+        else if (arg.rfind("--", 0)==0) {
+            std::cout << usage << std::endl;
+            throw std::runtime_error("Unknown command line option: "+arg);
+        }
+        else {
+            args.push_back(arg);
+        }
+    }
+
+    if (args.empty()) {
+        cl.configs.push_back(nlohmann::json::object());
+        return cl;
+    }
+    if (args.size()>2) {
+        std::cout << usage << std::endl;
+        throw std::runtime_error("More than two command line options is not permitted.");
+    }
+
+    // Assume that the first argument is a json parameter file
+    std::string fname = args[0];
+    std::ifstream f(fname);
+
+    if (!f.good()) {
+        throw std::runtime_error("Unable to open input parameter file: "+fname);
+    }
+
+    nlohmann::json json;
+    json << f;
+
+    for (auto& c: json.is_array()? json: nlohmann::json::array({json})) {
+        for (auto& e: expand_sweeps(c)) {
+            cl.configs.push_back(std::move(e));
+        }
+    }
+    // An empty list, or a sweep over no values, leaves nothing to run.
+    if (cl.configs.empty()) {
+        throw std::runtime_error("no runs in configuration "+fname+".");
+    }
+
     // Set optional output path if a second argument was passed
-    if (argc==3) {
-        params.odir = argv[2];
+    if (args.size()==2) {
+        cl.odir = args[1];
     }
 
-    return params;
+    return cl;
+}
+
+// Read the configurations of the runs from the command line.
+std::vector<ring_params> read_options(int argc, char** argv) {
+    const char* usage = "Usage:  arbor-busyring [--report=text|json] [--trace-out] [--bind-threads] [--bind-procs]\n"
+                        "                       [--ranks-per-numa=N] [params [opath]]\n\n"
+                        "Driver for the Arbor busyring benchmark\n\n"
+                        "Options:\n"
+                        "   --report: also write a json report to opath/<name>_report.json.\n"
+                        "   --trace-out: write a Chrome trace of the phases to opath/<name>_trace.json.\n"
+                        "   --bind-threads: bind each thread to a core.\n"
+                        "   --bind-procs: bind each rank to a disjoint set of cores.\n"
+                        "   --ranks-per-numa: bind N consecutive ranks on each host to each NUMA node.\n"
+                        "   params: JSON file with model parameters, or a list of them.\n"
+                        "   opath: output path.\n";
+
+    auto cl = read_command_line(argc, argv, usage);
+
+    std::vector<ring_params> runs;
+    for (auto& c: cl.configs) {
+        runs.push_back(params_from_json(std::move(c)));
+        runs.back().report = cl.report;
+        runs.back().trace_out = cl.trace_out;
+        cl.apply(runs.back().binding);
+        if (!cl.odir.empty()) {
+            runs.back().odir = cl.odir;
+        }
+    }
+
+    return runs;
 }
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef ARB_MPI_ENABLED
+#include <mpi.h>
+#endif
+
+// Hardware performance counters, read with perf_event_open at each metering checkpoint.
+//
+// The counters are opened for the whole process with inherit set, so that the
+// counts of every thread created after they are opened, which includes the
+// threads of the Arbor thread pool if they are opened before the context is made,
+// are summed into the count of the process. Only user space events are counted.
+//
+// Counters that can't be opened, e.g. because the CPU does not support them or
+// perf_event_paranoid forbids it, are reported as unavailable.
+class perf_counters {
+public:
+    static constexpr unsigned num_counters = 5;
+
+    static constexpr std::array<const char*, num_counters> names = {
+        "cycles", "instructions", "llc-misses", "branch-misses", "stalled-cycles"};
+
+    perf_counters() {
+        fds_.fill(-1);
+#ifdef __linux__
+        const std::array<std::uint64_t, num_counters> events = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES,
+            PERF_COUNT_HW_STALLED_CYCLES_BACKEND};
+
+        for (unsigned i=0; i<num_counters; ++i) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = events[i];
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED|PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds_[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+#endif
+        last_ = read();
+    }
+
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    ~perf_counters() {
+#ifdef __linux__
+        for (auto fd: fds_) {
+            if (fd>=0) close(fd);
+        }
+#endif
+    }
+
+    bool available() const {
+        for (auto fd: fds_) {
+            if (fd>=0) return true;
+        }
+        return false;
+    }
+
+    // Start a new set of phases.
+    void start() {
+        phases_.clear();
+        last_ = read();
+    }
+
+    // Record the counts since the last checkpoint as the phase called name.
+    void checkpoint(const std::string& name) {
+        auto now = read();
+        phase p{name, {}};
+        for (unsigned i=0; i<num_counters; ++i) {
+            p.counts[i] = now[i]<0? -1: now[i]-last_[i];
+        }
+        phases_.push_back(p);
+        last_ = now;
+    }
+
+    using counts_type = std::array<double, num_counters>;
+
+    // The counts of one phase summed over ranks, and the smallest and largest count of any rank.
+    // Counts are -1 if the counter is unavailable on any rank.
+    struct summary {
+        std::string name;
+        counts_type sum, min, max;
+    };
+
+    // Collective: the summary of each phase, which is valid on the root rank.
+    std::vector<summary> reduce() const {
+        std::vector<summary> result;
+        for (auto& p: phases_) {
+            summary s{p.name, p.counts, p.counts, p.counts};
+#ifdef ARB_MPI_ENABLED
+            MPI_Reduce(p.counts.data(), s.sum.data(), num_counters, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+            MPI_Reduce(p.counts.data(), s.min.data(), num_counters, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+            MPI_Reduce(p.counts.data(), s.max.data(), num_counters, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+#endif
+            for (unsigned i=0; i<num_counters; ++i) {
+                if (s.min[i]<0) s.sum[i] = s.max[i] = -1;
+            }
+            result.push_back(s);
+        }
+        return result;
+    }
+
+    // Print the counts of each phase summed over all threads and ranks.
+    // With more than one rank, the largest count of any one rank is also printed.
+    static void print(std::ostream& o, const std::vector<summary>& phases, unsigned nranks) {
+        o << std::setw(24) << std::left << "perf-counters" << std::right;
+        for (auto name: names) o << std::setw(16) << name;
+        o << std::setw(8) << "ipc" << "\n";
+
+        auto print_counts = [&o](const std::string& label, const counts_type& c) {
+            o << std::setw(24) << std::left << label << std::right;
+            for (auto x: c) {
+                o << std::setw(16);
+                if (x<0) o << "-"; else o << std::uint64_t(x);
+            }
+            o << std::setw(8);
+            if (c[0]>0 && c[1]>=0) o << std::fixed << std::setprecision(2) << c[1]/c[0];
+            else o << "-";
+            o << std::defaultfloat << "\n";
+        };
+        for (auto& p: phases) {
+            print_counts("perf-"+p.name, p.sum);
+            if (nranks>1) print_counts("perf-"+p.name+"-rank-max", p.max);
+        }
+    }
+
+    // The summed counts of each phase by counter name, with null for unavailable counters.
+    static nlohmann::json to_json(const std::vector<summary>& phases) {
+        nlohmann::json j;
+        for (auto& p: phases) {
+            auto& phase = j[p.name];
+            for (unsigned i=0; i<num_counters; ++i) {
+                if (p.sum[i]<0) phase[names[i]] = nullptr;
+                else phase[names[i]] = std::uint64_t(p.sum[i]);
+            }
+        }
+        return j;
+    }
+
+private:
+    struct phase {
+        std::string name;
+        counts_type counts;
+    };
+
+    // The current count of each counter, scaled for the time that it was not
+    // running when the counters are multiplexed, or -1 if it is unavailable.
+    counts_type read() const {
+        counts_type c;
+        c.fill(-1);
+#ifdef __linux__
+        for (unsigned i=0; i<num_counters; ++i) {
+            std::uint64_t v[3]; // value, time enabled, time running
+            if (fds_[i]>=0 && ::read(fds_[i], v, sizeof(v))==sizeof(v)) {
+                c[i] = v[2]? double(v[0])*v[1]/v[2]: 0;
+            }
+        }
+#endif
+        return c;
+    }
+
+    std::array<int, num_counters> fds_;
+    counts_type last_;
+    std::vector<phase> phases_;
+};
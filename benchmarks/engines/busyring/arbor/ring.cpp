@@ -4,8 +4,13 @@
 #include <sstream>
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <cmath>
 #include <cstring>
 #include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
 
 #include <nlohmann/json.hpp>
 
@@ -16,8 +21,9 @@
 #include <arbor/cable_cell.hpp>
 #include <arbor/profile/meter_manager.hpp>
 #include <arbor/profile/profiler.hpp>
-#include <arbor/simple_sampler.hpp>
+#include <arbor/sampling.hpp>
 #include <arbor/simulation.hpp>
+#include <arbor/symmetric_recipe.hpp>
 #include <arbor/recipe.hpp>
 #include <arbor/version.hpp>
 
@@ -26,7 +32,21 @@
 
 #include <arborio/label_parse.hpp>
 
+#include "affinity.hpp"
+#include "chrome_trace.hpp"
+#include "connectivity.hpp"
+#include "decomposition.hpp"
+#include "epoch_series.hpp"
+#include "memory_hwm.hpp"
 #include "parameters.hpp"
+#include "perf_counters.hpp"
+#include "rng.hpp"
+#include "run_report.hpp"
+#include "sample_pool.hpp"
+#include "spike_exchange.hpp"
+#include "spike_output.hpp"
+#include "spike_stats.hpp"
+#include "trace_output.hpp"
 
 #ifdef ARB_MPI_ENABLED
 #include <mpi.h>
@@ -43,10 +63,23 @@ using arb::cable_probe_membrane_voltage;
 
 using namespace arborio::literals;
 
-// Writes voltage trace as a json file.
-void write_trace_json(std::string fname, const arb::trace_data<double>& trace);
+// The parts of a cell description that are identical for every cell of a given type.
+struct cell_prototype {
+    arb::label_dict labels;
+    arb::decor decor;
+};
+
+// Generate the random morphology of a cell, seeded with gid.
+arb::segment_tree random_morphology(arb::cell_gid_type gid, const cell_parameters& params);
+
+// Generate the shared labels and decor of each cell type.
+cell_prototype branch_prototype(const cell_parameters& params);
+cell_prototype complex_prototype(const cell_parameters& params);
 
-// Generate a cell.
+// Assemble a cell from a morphology and a prototype.
+arb::cable_cell make_cell(arb::cell_gid_type gid, const arb::morphology& morph, const cell_prototype& proto, const cell_parameters& params);
+
+// Generate a cell from scratch, without the prototype cache.
 arb::cable_cell branch_cell(arb::cell_gid_type gid, const cell_parameters& params);
 arb::cable_cell complex_cell(arb::cell_gid_type gid, const cell_parameters& params);
 
@@ -67,57 +100,81 @@ public:
             gprop.default_parameters.init_membrane_potential = -90;
             event_weight_*=5;
         }
+
+        // Build the labels and decor shared by all cells, and optionally
+        // a fixed pool of morphologies that are reused round-robin by gid.
+        if (params.cell.prototype_cache) {
+            prototype_ = params.cell.complex_cell?
+                complex_prototype(params.cell):
+                branch_prototype(params.cell);
+
+            const auto nmorph = std::min(params.cell.unique_morphologies, num_cells_);
+            morphologies_.reserve(nmorph);
+            for (unsigned i=0; i<nmorph; ++i) {
+                morphologies_.push_back(arb::morphology(random_morphology(i, params.cell)));
+            }
+        }
     }
 
     std::any get_global_properties(cell_kind kind) const override { return gprop; }
     cell_size_type num_cells() const override { return num_cells_; }
     cell_kind get_cell_kind(cell_gid_type gid) const override { return cell_kind::cable; }
     arb::util::unique_any get_cell_description(cell_gid_type gid) const override {
-        if (params_.cell.complex_cell) {
-            return complex_cell(gid, params_.cell);
+        if (!prototype_) {
+            if (params_.cell.complex_cell) {
+                return complex_cell(gid, params_.cell);
+            }
+            return branch_cell(gid, params_.cell);
+        }
+
+        const auto nmorph = morphologies_.size();
+        if (nmorph) {
+            return make_cell(gid, morphologies_[gid%nmorph], *prototype_, params_.cell);
         }
-        return branch_cell(gid, params_.cell);
+        return make_cell(gid, arb::morphology(morphology_tree(gid)), *prototype_, params_.cell);
+    }
+
+    // The segment tree of the morphology used by cell gid.
+    arb::segment_tree morphology_tree(cell_gid_type gid) const {
+        const auto nmorph = morphologies_.size();
+        return random_morphology(nmorph? gid%nmorph: gid, params_.cell);
+    }
+
+    // The number of distinct morphologies, or zero if every cell has its own.
+    std::size_t num_unique_morphologies() const {
+        return morphologies_.size();
     }
 
     // Each cell has one incoming connection, from cell with gid-1,
     // and fan_in-1 random connections with very low weight.
     std::vector<arb::cell_connection> connections_on(cell_gid_type gid) const override {
-        std::vector<arb::cell_connection> cons;
-        const auto ncons = params_.cell.synapses;
-        cons.reserve(ncons);
-
-        const auto s = params_.ring_size;
-        const auto group = gid/s;
-        const auto group_start = s*group;
-        const auto group_end = std::min(group_start+s, num_cells_);
-        cell_gid_type src = gid==group_start? group_end-1: gid-1;
-        cons.push_back(arb::cell_connection({src, "detector"}, {"p_syn"}, event_weight_, min_delay_));
-
-        // Used to pick source cell for a connection.
-        std::uniform_int_distribution<cell_gid_type> dist(0, num_cells_-2);
-        // Used to pick delay for a connection.
-        std::uniform_real_distribution<float> delay_dist(0, 2*min_delay_);
-        auto src_gen = std::mt19937(gid);
-        for (unsigned i=1; i<ncons; ++i) {
-            // Make a connection with weight 0.
-            // The source is randomly picked, with no self connections.
-            src = dist(src_gen);
-            if (src==gid) ++src;
-            const float delay = min_delay_+delay_dist(src_gen);
-            cons.push_back(
-                arb::cell_connection({src, "detector"}, {"p_syn"}, 0.f, delay));
-        }
-        return cons;
+        return ring_connections(gid, params_, event_weight_);
     }
 
     // Return one event generator on the first cell of each ring.
     // This generates a single event that will kick start the spiking on the sub-ring.
+    // Cells that receive background input also have a Poisson event generator.
     std::vector<arb::event_generator> event_generators(cell_gid_type gid) const override {
+        std::vector<arb::event_generator> gens;
         if (gid%params_.ring_size == 0) {
-            return {arb::explicit_generator({{{"p_syn"}, 1.0, event_weight_}})};
-        } else {
-            return {};
+            gens.push_back(arb::explicit_generator({{{"p_syn"}, 1.0, event_weight_}}));
         }
+
+        auto& bg = params_.background;
+        if (bg.rate>0 && has_background(gid)) {
+            // Seed the generator of each cell from its own random stream.
+            auto r = rng::block(gid, rng::background, 0);
+            std::mt19937_64 gen((std::uint64_t(r[0])<<32)|r[1]);
+            gens.push_back(arb::poisson_generator({"p_syn"}, bg.weight, 0, bg.rate/1000, gen));
+        }
+        return gens;
+    }
+
+    // Whether cell gid receives background input: the targets are spread evenly over the gids.
+    bool has_background(cell_gid_type gid) const {
+        const std::uint64_t n = num_cells_;
+        const std::uint64_t t = params_.background.targets? std::min<std::uint64_t>(params_.background.targets, n): n;
+        return (gid+1)*t/n > gid*t/n;
     }
 
     std::vector<arb::probe_info> get_probes(cell_gid_type gid) const override {
@@ -132,43 +189,109 @@ private:
     ring_params params_;
     float event_weight_ = 0.01;
 
+    std::optional<cell_prototype> prototype_;
+    std::vector<arb::morphology> morphologies_;
+
     arb::cable_cell_global_properties gprop;
 };
 
+// The cells of the first rank of a dry run, which arb::symmetric_recipe copies to
+// each of the other ranks, shifting the sources of their connections by the first
+// gid of the copy. The cells are those of the ring recipe of the whole network.
+class ring_tile: public arb::tile {
+public:
+    ring_tile(const ring_recipe& r, unsigned nranks):
+        recipe_(r), num_cells_(r.num_cells()/nranks), num_tiles_(nranks)
+    {}
+
+    cell_size_type num_cells() const override { return num_cells_; }
+    cell_size_type num_tiles() const override { return num_tiles_; }
+
+    std::any get_global_properties(cell_kind kind) const override { return recipe_.get_global_properties(kind); }
+    cell_kind get_cell_kind(cell_gid_type gid) const override { return recipe_.get_cell_kind(gid); }
+    arb::util::unique_any get_cell_description(cell_gid_type gid) const override { return recipe_.get_cell_description(gid); }
+    std::vector<arb::cell_connection> connections_on(cell_gid_type gid) const override { return recipe_.connections_on(gid); }
+    std::vector<arb::event_generator> event_generators(cell_gid_type gid) const override { return recipe_.event_generators(gid); }
+    std::vector<arb::probe_info> get_probes(cell_gid_type gid) const override { return recipe_.get_probes(gid); }
+
+private:
+    const ring_recipe& recipe_;
+    cell_size_type num_cells_;
+    cell_size_type num_tiles_;
+};
+
+// The number of branches in a segment tree, using the same rule as arb::morphology:
+// a branch starts at every root segment, and at every child of a fork point.
+unsigned count_branches(const arb::segment_tree& tree) {
+    const auto& parents = tree.parents();
+    std::vector<unsigned> nchild(parents.size(), 0);
+    for (auto p: parents) {
+        if (p!=arb::mnpos) ++nchild[p];
+    }
+    unsigned nbranch = 0;
+    for (auto p: parents) {
+        if (p==arb::mnpos || nchild[p]>1) ++nbranch;
+    }
+    return nbranch;
+}
+
 struct cell_stats {
     using size_type = unsigned;
     size_type ncells = 0;
     size_type nbranch = 0;
     size_type ncomp = 0;
 
-    cell_stats(arb::recipe& r) {
-#ifdef ARB_MPI_ENABLED
-        int nranks, rank;
-        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-        MPI_Comm_size(MPI_COMM_WORLD, &nranks);
+    // The number of CVs of each cell in the block of gids of this rank, which
+    // is used as the cost of the cell by the cost-weighted decomposition.
+    std::vector<double> local_costs;
+
+    // The statistics are computed from the segment tree of each cell, without building
+    // cable cells. Cells are split evenly over ranks, and each rank splits its cells
+    // over as many threads as the context has, before the counts are summed over ranks.
+    // In a dry run, the cells of the ranks that are not simulated are copies of the
+    // cells of the first rank.
+    cell_stats(const ring_recipe& r, const arb::context& ctx) {
         ncells = r.num_cells();
-        size_type cells_per_rank = ncells/nranks;
-        size_type b = rank*cells_per_rank;
-        size_type e = (rank==nranks-1)? ncells: (rank+1)*cells_per_rank;
-        size_type nbranch_tmp = 0;
-        for (size_type i=b; i<e; ++i) {
-            auto c = arb::util::any_cast<arb::cable_cell>(r.get_cell_description(i));
-            nbranch_tmp += c.morphology().num_branches();
-            for (unsigned i = 0; i < c.morphology().num_branches(); ++i) {
-                ncomp += c.morphology().branch_segments(i).size();
+        const auto block = cell_block(ncells, arb::rank(ctx), arb::num_ranks(ctx));
+        const size_type b = block.first;
+        const size_type nlocal = block.second-block.first;
+        local_costs.resize(nlocal);
+
+        const size_type nthreads = std::max(1u, std::min<size_type>(arb::num_threads(ctx), nlocal));
+        std::vector<std::array<size_type, 2>> partial(nthreads);
+        auto count = [&](size_type t) {
+            std::array<size_type, 2> c = {0, 0};
+            for (size_type i=b+t*nlocal/nthreads; i<b+(t+1)*nlocal/nthreads; ++i) {
+                auto tree = r.morphology_tree(i);
+                c[0] += count_branches(tree);
+                c[1] += tree.size();
+                local_costs[i-b] = tree.size();
             }
+            partial[t] = c;
+        };
+
+        std::vector<std::thread> workers;
+        for (size_type t=1; t<nthreads; ++t) {
+            workers.emplace_back(count, t);
         }
-        MPI_Allreduce(&nbranch_tmp, &nbranch, 1, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD);
-#else
-        ncells = r.num_cells();
-        for (size_type i=0; i<ncells; ++i) {
-            auto c = arb::util::any_cast<arb::cable_cell>(r.get_cell_description(i));
-            nbranch += c.morphology().num_branches();
-            for (unsigned i = 0; i < c.morphology().num_branches(); ++i) {
-                ncomp += c.morphology().branch_segments(i).size();
-            }
+        count(0);
+        for (auto& w: workers) w.join();
+
+        std::array<size_type, 2> local = {0, 0};
+        for (auto& c: partial) {
+            local[0] += c[0];
+            local[1] += c[1];
         }
+
+#ifdef ARB_MPI_ENABLED
+        std::array<size_type, 2> global;
+        MPI_Allreduce(local.data(), global.data(), 2, MPI_UNSIGNED, MPI_SUM, MPI_COMM_WORLD);
+#else
+        auto global = local;
 #endif
+        const auto copies = ranks_per_process(arb::num_ranks(ctx));
+        nbranch = global[0]*copies;
+        ncomp = global[1]*copies;
     }
 
     friend std::ostream& operator<<(std::ostream& o, const cell_stats& s) {
@@ -179,140 +302,608 @@ struct cell_stats {
     }
 };
 
-int main(int argc, char** argv) {
-    try {
-        bool root = true;
-
-        auto params = read_options(argc, argv);
+// Sinks for the samples and spikes of one run of the simulation.
+struct run_outputs {
+    std::unique_ptr<sample_pool> samples;
+    std::size_t num_sampled_cells = 0;
+    std::unique_ptr<spike_writer> spike_out;
+#ifdef ARB_MPI_ENABLED
+    std::unique_ptr<mpiio_spike_writer> mpiio_spike_out;
+#endif
+    std::unique_ptr<spike_stats> spike_summary;
+    std::unique_ptr<epoch_series> epochs;
+    std::optional<epoch_summary> epoch_stats;   // Set on the root rank by finish_outputs.
+    std::unique_ptr<spike_exchange> exchange;
+    std::optional<spike_exchange::summary> exchange_stats;  // Set on the root rank by finish_outputs.
+};
 
-        arb::proc_allocation resources;
-        resources.num_threads = arbenv::default_concurrency();
+// Attach samplers and spike callbacks to a simulation.
+// The fan-out of each gid onto the local cells is used by the epoch series and
+// the spike exchange statistics, and must outlive the outputs.
+run_outputs attach_outputs(arb::simulation& sim, const ring_params& params, const arb::context& context,
+                           const arb::domain_decomposition& decomp, const std::vector<std::uint32_t>& fanout)
+{
+    run_outputs out;
+    const bool root = arb::rank(context)==0;
+
+    // A simulation has one local and one global spike callback, which call
+    // every output that is attached to them.
+    std::vector<arb::spike_export_function> local_callbacks, global_callbacks;
+
+    // Set up the samplers that will measure voltage at the soma of the selected cells,
+    // storing the samples in per-thread buffers.
+    if (params.record_voltage) {
+        auto gids = sampled_gids(params.sampling, params.num_cells);
+        std::vector<char> selected(params.num_cells, 0);
+        std::size_t nlocal = 0;
+        for (auto gid: gids) {
+            selected[gid] = 1;
+            if (decomp.gid_domain(gid)==int(arb::rank(context))) ++nlocal;
+        }
+        auto nsamples = nlocal*std::size_t(params.duration/params.sampling.interval+1);
+        out.samples = std::make_unique<sample_pool>(num_threads(context), nsamples);
+        out.num_sampled_cells = gids.size();
+
+        // Every cell has one probe at the soma, with index 0.
+        auto probes = [selected=std::move(selected)](cell_member_type id) {
+            return id.index==0 && selected[id.gid];
+        };
+        auto sched = arb::regular_schedule(params.sampling.interval);
+        sim.add_sampler(probes, sched, out.samples->sampler());
+    }
 
+    // Set up output of spikes: either streamed to file on the root process,
+    // or with each rank writing the spikes generated by its own cells.
+    const bool spike_files = params.spike_output!=spike_format::stats;
+    const auto spike_ext = spike_file_extension(params.spike_output);
+    if (spike_files && (root || params.spike_gather==spike_gather_kind::rank_files)) {
+        const bool global = params.spike_gather==spike_gather_kind::root;
+        auto fname = params.odir + "/" + params.name + "_spikes." +
+            (global? spike_ext: std::to_string(arb::rank(context)) + "." + spike_ext);
+        out.spike_out = std::make_unique<spike_writer>(fname, params.spike_output, params.spike_sort, params.spike_buffer);
+        if (!out.spike_out->good()) {
+            std::cerr << "Warning: unable to open file " << fname << " for spike output\n";
+            out.spike_out.reset();
+        }
+        else {
+            auto append = [w=out.spike_out.get()](const std::vector<arb::spike>& spikes) {
+                w->append(spikes);
+            };
+            (global? global_callbacks: local_callbacks).push_back(append);
+        }
+    }
 #ifdef ARB_MPI_ENABLED
-        arbenv::with_mpi guard(argc, argv, false);
-        resources.gpu_id = arbenv::find_private_gpu(MPI_COMM_WORLD);
-        auto context = arb::make_context(resources, MPI_COMM_WORLD);
-        root = arb::rank(context) == 0;
-#else
-        resources.gpu_id = arbenv::default_gpu();
-        auto context = arb::make_context(resources);
+    if (spike_files && params.spike_gather==spike_gather_kind::mpi_io) {
+        out.mpiio_spike_out = std::make_unique<mpiio_spike_writer>(params.spike_output, params.spike_sort);
+        local_callbacks.push_back(
+            [w=out.mpiio_spike_out.get()](const std::vector<arb::spike>& spikes) {
+                w->append(spikes);
+            });
+    }
 #endif
+    // Or only keep running statistics of the spikes on each rank.
+    if (!spike_files) {
+        out.spike_summary = std::make_unique<spike_stats>(params.num_cells, params.ring_size,
+            params.dry_run_ranks? params.num_cells/params.dry_run_ranks: params.num_cells);
+        local_callbacks.push_back(
+            [s=out.spike_summary.get()](const std::vector<arb::spike>& spikes) {
+                s->append(spikes);
+            });
+    }
 
-#ifdef ARB_PROFILE_ENABLED
-        arb::profile::profiler_initialize(context);
+    // The wall time, spikes and events of each epoch, which needs the spikes of all ranks on every rank.
+    if (params.epoch_series!=epoch_format::none) {
+        out.epochs = std::make_unique<epoch_series>(
+            epoch_series::expected_epochs(params.duration, params.min_delay));
+        out.epochs->attach(sim);
+    }
+
+    // The spikes generated and received by each rank in each epoch.
+    if (params.spike_exchange) {
+        out.exchange = std::make_unique<spike_exchange>(
+            epoch_series::expected_epochs(params.duration, params.min_delay), fanout, decomp);
+        local_callbacks.push_back(
+            [x=out.exchange.get()](const std::vector<arb::spike>& spikes) {
+                x->generated(spikes);
+            });
+    }
+
+    // Both count the events of the gathered spikes, which are scanned once for both.
+    if (out.epochs || out.exchange) {
+        global_callbacks.push_back(
+            [e=out.epochs.get(), x=out.exchange.get(), &fanout](const std::vector<arb::spike>& spikes) {
+                const auto events = x? x->gathered(spikes): fanout_events(fanout, spikes);
+                if (e) e->exchange(spikes.size(), events);
+            });
+    }
+
+    auto call_all = [](std::vector<arb::spike_export_function> callbacks) -> arb::spike_export_function {
+        if (callbacks.size()==1) return callbacks.front();
+        return [callbacks=std::move(callbacks)](const std::vector<arb::spike>& spikes) {
+            for (auto& f: callbacks) f(spikes);
+        };
+    };
+    if (!local_callbacks.empty()) sim.set_local_spike_callback(call_all(std::move(local_callbacks)));
+    if (!global_callbacks.empty()) sim.set_global_spike_callback(call_all(std::move(global_callbacks)));
+
+    return out;
+}
+
+// Write the remaining spikes, the spike statistics and the samples to file.
+void finish_outputs(run_outputs& out, const ring_params& params, const arb::context& context) {
+    const bool root = arb::rank(context)==0;
+
+    if (out.spike_out) out.spike_out->close();
+#ifdef ARB_MPI_ENABLED
+    if (out.mpiio_spike_out) {
+        auto fname = params.odir + "/" + params.name + "_spikes." + spike_file_extension(params.spike_output);
+        if (!out.mpiio_spike_out->write(fname, MPI_COMM_WORLD) && root) {
+            std::cerr << "Warning: unable to open file " << fname << " for spike output\n";
+        }
+    }
 #endif
+    if (out.spike_summary) {
+        out.spike_summary->reduce();
+        if (root) {
+            std::cout << *out.spike_summary << "\n";
+            std::ofstream fid(params.odir + "/" + params.name + "_spike_stats.json");
+            fid << std::setw(1) << out.spike_summary->to_json(params.duration) << "\n";
+        }
+    }
+
+    // Write the samples to file if samples were stored on this rank.
+    if (out.samples && out.samples->size()) {
+        auto ext = trace_file_extension(params.trace_output);
+        auto fname = params.odir + "/" + params.name + "_voltages." +
+            (num_ranks(context)>1? std::to_string(arb::rank(context)) + "." + ext: ext);
+        write_trace(fname, params.trace_output, out.samples->collect());
+    }
 
-        // Print a banner with information about hardware configuration
+    if (out.epochs) {
+        auto series = out.epochs->reduce(context);
         if (root) {
-            std::cout << "gpu:      " << (has_gpu(context)? "yes": "no") << "\n";
-            std::cout << "threads:  " << num_threads(context) << "\n";
-            std::cout << "mpi:      " << (has_mpi(context)? "yes": "no") << "\n";
-            std::cout << "ranks:    " << num_ranks(context) << "\n" << std::endl;
+            out.epoch_stats = epoch_summary(series);
+            std::cout << *out.epoch_stats << "\n";
+            auto fname = params.odir + "/" + params.name + "_epochs." + epoch_file_extension(params.epoch_series);
+            write_epochs(fname, params.epoch_series, series);
         }
+    }
 
-        arb::profile::meter_manager meters;
-        meters.start(context);
+    if (out.exchange) {
+        auto stats = out.exchange->reduce(context);
+        if (root) {
+            std::cout << stats << "\n";
+            write_exchange_csv(params.odir + "/" + params.name + "_exchange.csv", stats);
+            out.exchange_stats = std::move(stats);
+        }
+    }
+}
 
-        // Create an instance of our recipe.
-        ring_recipe recipe(params);
-        cell_stats stats(recipe);
-        if (root) std::cout << stats << "\n";
+// The benchmark report in json format (schema version 1):
+//
+//   name, benchmark, simulator     identify the run.
+//   resources                      ranks, threads, gpu and mpi.
+//   model                          cells, branches, compartments, duration and dt.
+//   spikes                         the number of spikes generated by the last run.
+//   checkpoints, meters            the meter report, in the layout of the NEURON
+//                                  benchmark's meters.json: a list of meters, each
+//                                  with one measurement per rank for each checkpoint.
+//   run-time                       statistics of the wall time of the timed runs.
+//   memory-hwm                     peak resident memory of each phase over ranks.
+//   epoch-series                   percentiles of the epoch wall time, with epoch-series.
+//   spike-exchange                 spikes and bytes of each rank and epoch, with spike-exchange.
+//   perf-counters                  counts of each phase, if counters were enabled.
+nlohmann::json json_report(const ring_params& params, const arb::context& context, const cell_stats& stats,
+                           const arb::profile::meter_report& report, std::uint64_t num_spikes, const run_stats& times)
+{
+    nlohmann::json j;
+    j["schema-version"] = 1;
+    j["name"] = params.name;
+    j["benchmark"] = "busyring";
+    j["simulator"] = "arbor";
+    j["resources"] = {
+        {"ranks", num_ranks(context)},
+        {"threads", num_threads(context)},
+        {"gpu", has_gpu(context)},
+        {"mpi", has_mpi(context)}
+    };
+    j["model"] = {
+        {"cells", stats.ncells},
+        {"branches", stats.nbranch},
+        {"compartments", stats.ncomp},
+        {"connectivity", connectivity_name(params.connectivity.kind)},
+        {"duration", params.duration},
+        {"dt", params.dt}
+    };
+    j["spikes"] = num_spikes;
+    add_meters(j, report);
+    j["run-time"] = times.to_json();
+    return j;
+}
 
-        auto decomp = arb::partition_load_balance(recipe, context);
+// The performance of one run, for the summary of an ensemble of runs.
+struct run_summary {
+    std::string name;
+    unsigned cells;
+    unsigned cpu_group_size;
+    double time;            // Median wall time of the timed runs [s].
 
-        // Construct the model.
-        arb::simulation sim(recipe, context, decomp);
+    double throughput() const {
+        return time>0? cells/time: 0;
+    }
+};
 
-        // Set up the probe that will measure voltage in the cell.
+// Print a table of the performance of each run of an ensemble.
+void print_summary(std::ostream& o, const std::vector<run_summary>& runs) {
+    auto best = std::max_element(runs.begin(), runs.end(),
+        [](auto& l, auto& r) { return l.throughput()<r.throughput(); });
+
+    o << "\nsummary of " << runs.size() << " runs\n";
+    o << std::left << std::setw(40) << "run" << std::right
+      << std::setw(10) << "cells" << std::setw(16) << "cpu-group-size"
+      << std::setw(12) << "wall(s)" << std::setw(14) << "cells/s" << "\n";
+    for (auto it=runs.begin(); it!=runs.end(); ++it) {
+        o << std::left << std::setw(40) << it->name << std::right
+          << std::setw(10) << it->cells << std::setw(16) << it->cpu_group_size
+          << std::setw(12) << std::fixed << std::setprecision(3) << it->time
+          << std::setw(14) << std::setprecision(1) << it->throughput()
+          << std::defaultfloat << (it==best? "  *": "") << "\n";
+    }
+}
 
-        // This is where the voltage samples will be stored as (time, value) pairs
-        arb::trace_vector<double> voltage;
-        if (params.record_voltage) {
-            // The id of the only probe on the cell:
-            // the cell_member type points to (cell 0, probe 0)
-            auto probe_id = cell_member_type{0, 0};
-            // The schedule for sampling is 10 samples every 1 ms.
-            auto sched = arb::regular_schedule(0.1);
-            // Now attach the sampler at probe_id, with sampling schedule sched, writing to voltage
-            sim.add_sampler(arb::one_probe(probe_id), sched, arb::make_simple_sampler(voltage));
+// Build and run the model described by params, and report its performance.
+// If counters is not null, hardware counters are also reported for each phase.
+run_summary run_model(const ring_params& params, const arb::context& context, perf_counters* counters) {
+    const bool root = arb::rank(context)==0;
+    if (!params.perf_counters) counters = nullptr;
+
+    // Print a banner with information about hardware configuration
+    if (root) {
+        std::cout << "gpu:      " << (has_gpu(context)? "yes": "no") << "\n";
+        std::cout << "threads:  " << num_threads(context) << "\n";
+        std::cout << "mpi:      " << (has_mpi(context)? "yes": "no") << "\n";
+        std::cout << "ranks:    " << num_ranks(context) << "\n";
+        std::cout << "binding:  threads " << (params.binding.bind_threads? "yes": "no")
+                  << "; procs " << (params.binding.bind_procs? "yes": "no")
+                  << "; ranks-per-numa " << params.binding.ranks_per_numa << "\n";
+        if (params.dry_run_ranks) {
+            std::cout << "dry-run:  " << params.dry_run_ranks << " ranks; "
+                      << params.num_cells/params.dry_run_ranks << " cells per rank\n";
         }
+    }
 
-        // Set up recording of spikes to a vector on the root process.
-        std::vector<arb::spike> recorded_spikes;
-        if (root) {
-            sim.set_global_spike_callback(
-                [&recorded_spikes](const std::vector<arb::spike>& spikes) {
-                    recorded_spikes.insert(recorded_spikes.end(), spikes.begin(), spikes.end());
-                });
-        }
+    // The cpus that each thread of each rank can run on.
+    auto affinity = gather_affinity(context);
+    if (root) {
+        print_affinity(std::cout, affinity);
+        std::cout << std::endl;
+    }
 
-        meters.checkpoint("model-init", context);
+    arb::profile::meter_manager meters;
+    memory_hwm hwm;
+    std::optional<chrome_trace> trace;
+    if (params.trace_out) trace.emplace();
+    meters.start(context);
+    hwm.start();
+    if (trace) trace->start();
+    if (counters) counters->start();
+
+    auto checkpoint = [&](const char* name) {
+        meters.checkpoint(name, context);
+        hwm.checkpoint(name);
+        if (trace) trace->checkpoint(name);
+        if (counters) counters->checkpoint(name);
+    };
+
+    // Create an instance of our recipe.
+    ring_recipe recipe(params);
+    // In a dry run the model is simulated with copies of the cells of the first rank.
+    std::unique_ptr<arb::symmetric_recipe> dry_run_recipe;
+    if (params.dry_run_ranks) {
+        dry_run_recipe = std::make_unique<arb::symmetric_recipe>(std::make_unique<ring_tile>(recipe, params.dry_run_ranks));
+    }
+    const arb::recipe& model = dry_run_recipe? static_cast<const arb::recipe&>(*dry_run_recipe): recipe;
+    checkpoint("model-recipe");
+
+    cell_stats stats(recipe, context);
+    checkpoint("model-stats");
+    if (root) {
+        std::cout << stats << "\n";
+        if (params.cell.prototype_cache) {
+            std::cout << "cell cache: prototype; ";
+            if (auto n = recipe.num_unique_morphologies()) {
+                std::cout << n << " unique morphologies\n";
+            }
+            else {
+                std::cout << "one morphology per cell\n";
+            }
+        }
+        else {
+            std::cout << "cell cache: none\n";
+        }
+    }
 
-        // Run the simulation.
-        if (root) std::cout << "running simulation" << std::endl;
-        sim.set_binning_policy(arb::binning_kind::regular, params.dt);
-        sim.run(params.duration, params.dt);
+    arb::partition_hint hint;
+    hint.cpu_group_size = params.partition.cpu_group_size;
+    if (params.partition.gpu_group_size) hint.gpu_group_size = params.partition.gpu_group_size;
+    hint.prefer_gpu = params.partition.prefer_gpu;
+    auto default_partition = [&]() {
+        return arb::partition_load_balance(model, context, {{arb::cell_kind::cable, hint}});
+    };
+
+    // The costs of all cells are only gathered in the phase for the cost-weighted decomposition.
+    std::vector<double> costs;
+    if (params.partition.kind==decomposition_kind::weighted) {
+        costs = gather_costs(stats.local_costs, stats.ncells, context);
+    }
+    auto decomp =
+        params.partition.kind==decomposition_kind::weighted? partition_by_cost(recipe, context, costs, params.partition):
+        params.partition.kind==decomposition_kind::ring? partition_by_ring(recipe, context, params.ring_size, params.partition):
+        default_partition();
+    checkpoint("model-decompose");
+
+    // The imbalance of the cost, the number of CVs, of cells over ranks and groups is
+    // reported for the default decomposition, and for the one used if it is another.
+    // It is computed after the phase, which would otherwise also time the gather of
+    // the costs, and the default decomposition that isn't used.
+    if (params.partition.kind!=decomposition_kind::weighted) {
+        costs = gather_costs(stats.local_costs, stats.ncells, context);
+    }
+    imbalance decomp_imbalance(decomp, costs);
+    imbalance default_imbalance = params.partition.kind==decomposition_kind::load_balance?
+        decomp_imbalance: imbalance(default_partition(), costs);
 
-        meters.checkpoint("model-run", context);
+    unsigned long ngroups = decomp.num_groups();
+#ifdef ARB_MPI_ENABLED
+    MPI_Allreduce(MPI_IN_PLACE, &ngroups, 1, MPI_UNSIGNED_LONG, MPI_SUM, MPI_COMM_WORLD);
+#endif
+    ngroups *= ranks_per_process(num_ranks(context));
+    if (root) {
+        std::cout << "partition: " << ngroups << " cell groups; "
+                  << "cpu-group-size " << hint.cpu_group_size << "; "
+                  << "prefer-gpu " << (hint.prefer_gpu? "yes": "no") << "\n";
+        std::cout << "imbalance: default " << default_imbalance;
+        if (params.partition.kind!=decomposition_kind::load_balance) {
+            std::cout << "; " << decomposition_name(params.partition.kind) << " " << decomp_imbalance;
+        }
+        std::cout << "\n";
+    }
 
-        auto ns = sim.num_spikes();
+    // Construct the model.
+    auto sim = std::make_unique<arb::simulation>(model, context, decomp);
+    checkpoint("model-build");
+
+    // Set up the samplers and the spike output.
+    std::vector<std::uint32_t> fanout;
+    if (params.epoch_series!=epoch_format::none || params.spike_exchange) fanout = local_fanout(model, decomp);
+    auto outputs = attach_outputs(*sim, params, context, decomp, fanout);
+    checkpoint("model-outputs");
+    if (root && outputs.samples) {
+        std::cout << "sampling: " << outputs.num_sampled_cells << " cells every "
+                  << params.sampling.interval << " ms\n";
+    }
 
-        // Write spikes to file
-        if (root) {
-            std::cout << "\n" << ns << " spikes generated at rate of "
-                      << params.duration/ns << " ms between spikes\n";
-            std::ofstream fid(params.odir + "/" + params.name + "_spikes.gdf");
-            if (!fid.good()) {
-                std::cerr << "Warning: unable to open file spikes.gdf for spike output\n";
+    // Run the simulation: first the warm-up runs, then the timed repetitions.
+    if (root) std::cout << "running simulation" << std::endl;
+    std::vector<double> run_times;
+    const unsigned nruns = params.warmup+params.repetitions;
+    for (unsigned i=0; i<nruns; ++i) {
+        if (i>0) {
+            // Start again from scratch, and discard the output of the previous run.
+            outputs = run_outputs();
+            if (params.rebuild) {
+                sim.reset();
+                sim = std::make_unique<arb::simulation>(model, context, decomp);
             }
             else {
-                char linebuf[45];
-                for (auto spike: recorded_spikes) {
-                    auto n = std::snprintf(
-                        linebuf, sizeof(linebuf), "%u %.4f\n",
-                        unsigned{spike.source.gid}, float(spike.time));
-                    fid.write(linebuf, n);
-                }
+                sim->reset();
+                sim->remove_all_samplers();
             }
+            outputs = attach_outputs(*sim, params, context, decomp, fanout);
         }
 
-        // Write the samples to a json file samples were stored on this rank.
-        if (voltage.size()>0u) {
-            std::string fname = params.odir + "/" + params.name + "_voltages.json";
-            write_trace_json(fname, voltage.at(0));
+        sim->set_binning_policy(arb::binning_kind::regular, params.dt);
+#ifdef ARB_MPI_ENABLED
+        MPI_Barrier(MPI_COMM_WORLD);
+#endif
+        if (outputs.epochs) outputs.epochs->start();
+        auto t0 = std::chrono::steady_clock::now();
+        sim->run(params.duration, params.dt);
+#ifdef ARB_MPI_ENABLED
+        MPI_Barrier(MPI_COMM_WORLD);
+#endif
+        auto t1 = std::chrono::steady_clock::now();
+
+        if (i<params.warmup) {
+            if (i+1==params.warmup) checkpoint("model-warmup");
+        }
+        else {
+            run_times.push_back(std::chrono::duration<double>(t1-t0).count());
         }
+    }
+
+    checkpoint("model-run");
 
-        auto report = arb::profile::make_meter_report(meters, context);
-        if (root) std::cout << report;
+    auto ns = sim->num_spikes();
+
+    if (root) {
+        std::cout << "\n" << ns << " spikes generated at rate of "
+                  << params.duration/ns << " ms between spikes\n";
     }
-    catch (std::exception& e) {
-        std::cerr << "exception caught in ring miniapp: " << e.what() << "\n";
-        return 1;
+
+    // Write the output of the last run.
+    finish_outputs(outputs, params, context);
+
+    auto report = arb::profile::make_meter_report(meters, context);
+    if (root) std::cout << report;
+
+    // Computed after the last checkpoint, so that it isn't part of any phase.
+    std::optional<cross_rank_connections> cross_rank;
+    if (params.cross_rank_stats) {
+        cross_rank.emplace(model, decomp);
+        if (root) std::cout << "cross-rank connections: " << *cross_rank << "\n";
     }
 
-    return 0;
+    // The peak resident memory of each phase over ranks, which the meters only report for the root rank.
+    auto peaks = hwm.reduce();
+    if (root) memory_hwm::print(std::cout, peaks, hwm.cumulative());
+
+    std::vector<perf_counters::summary> counts;
+    if (counters) {
+        counts = counters->reduce();
+        if (root) perf_counters::print(std::cout, counts, num_ranks(context));
+    }
+
+    if (trace) trace->write(params.odir + "/" + params.name + "_trace.json", context);
+
+    // Statistics of the time taken by each timed repetition of sim.run().
+    run_stats times(run_times);
+    if (root && (params.repetitions>1 || params.warmup>0)) {
+        std::cout << times << "\n";
+    }
+
+    if (root && params.report==report_format::json) {
+        auto j = json_report(params, context, stats, report, ns, times);
+        j["decomposition"] = {
+            {"kind", decomposition_name(params.partition.kind)},
+            {"groups", ngroups},
+            {"imbalance", {
+                {"ranks", decomp_imbalance.ranks},
+                {"groups", decomp_imbalance.groups}}},
+            {"default-imbalance", {
+                {"ranks", default_imbalance.ranks},
+                {"groups", default_imbalance.groups}}}
+        };
+        if (cross_rank) {
+            j["decomposition"]["cross-rank-connections"] = {
+                {"all", cross_rank->all},
+                {"weighted", cross_rank->weighted}
+            };
+        }
+        j["resources"]["binding"] = {
+            {"bind-threads", params.binding.bind_threads},
+            {"bind-procs", params.binding.bind_procs},
+            {"ranks-per-numa", params.binding.ranks_per_numa}
+        };
+        if (params.dry_run_ranks) {
+            j["resources"]["dry-run"] = {
+                {"ranks", params.dry_run_ranks},
+                {"cells-per-rank", params.num_cells/params.dry_run_ranks}
+            };
+        }
+        j["affinity"] = nlohmann::json::array();
+        for (auto& t: affinity) {
+            j["affinity"].push_back({{"rank", t.rank}, {"tid", t.tid}, {"cpus", t.cpus}});
+        }
+        j["memory-hwm"] = memory_hwm::to_json(peaks, hwm.cumulative());
+        if (outputs.epoch_stats) j["epoch-series"] = outputs.epoch_stats->to_json();
+        if (outputs.exchange_stats) {
+            j["spike-exchange"] = outputs.exchange_stats->to_json();
+            j["spike-exchange"]["per-rank-epoch"] = params.name + "_exchange.csv";
+        }
+        if (counters) j["perf-counters"] = perf_counters::to_json(counts);
+        std::ofstream fid(params.odir + "/" + params.name + "_report.json");
+        fid << std::setw(1) << j << "\n";
+    }
+
+    // Time spent in the samplers during the last run, which is not broken out by the meters.
+    if (auto& samples = outputs.samples) {
+        std::array<double, 3> local = {samples->total_seconds(), samples->max_seconds(), double(samples->size())};
+#ifdef ARB_MPI_ENABLED
+        std::array<double, 3> global;
+        MPI_Reduce(local.data(), global.data(), 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce(local.data()+1, global.data()+1, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        MPI_Reduce(local.data()+2, global.data()+2, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+#else
+        auto global = local;
+#endif
+        if (root) {
+            std::cout << "meter-sampler " << std::fixed << std::setprecision(3)
+                      << global[0] << " s in samplers over all threads; "
+                      << global[1] << " s max per thread; "
+                      << std::size_t(global[2]) << " samples\n";
+        }
+    }
+
+    return {params.name, stats.ncells, params.partition.cpu_group_size, times.median()};
 }
 
-void write_trace_json(std::string fname, const arb::trace_data<double>& trace) {
-    nlohmann::json json;
-    json["name"] = "ring demo";
-    json["units"] = "mV";
-    json["cell"] = "0.0";
-    json["probe"] = "0";
+int main(int argc, char** argv) {
+    try {
+        bool root = true;
+
+        auto runs = read_options(argc, argv);
 
-    auto& jt = json["data"]["time"];
-    auto& jy = json["data"]["voltage"];
+        // All runs share the context, and so the binding of the first run.
+        const auto binding = runs.front().binding;
+        for (auto& params: runs) params.binding = binding;
 
-    for (const auto& sample: trace) {
-        jt.push_back(sample.t);
-        jy.push_back(sample.v);
+        // As do the dry run ranks and cells per rank.
+        share_dry_run(runs);
+        const auto dry_run_ranks = runs.front().dry_run_ranks;
+        auto make_dry_run_context = [&](const arb::proc_allocation& resources) {
+            const auto& first = runs.front();
+            return arb::make_context(resources, arb::dry_run_info(dry_run_ranks, first.num_cells/dry_run_ranks));
+        };
+
+        arb::proc_allocation resources;
+        resources.num_threads = arbenv::default_concurrency();
+        resources.bind_threads = binding.bind_threads;
+        resources.bind_procs = binding.bind_procs;
+
+        // Hardware counters only count threads started after they are opened,
+        // so they are opened before the context creates the thread pool.
+        std::unique_ptr<perf_counters> counters;
+        if (std::any_of(runs.begin(), runs.end(), [](auto& p) { return p.perf_counters; })) {
+            counters = std::make_unique<perf_counters>();
+            if (!counters->available()) {
+                std::cerr << "Warning: hardware performance counters are not available\n";
+                counters.reset();
+            }
+        }
+
+#ifdef ARB_MPI_ENABLED
+        arbenv::with_mpi guard(argc, argv, false);
+        resources.gpu_id = arbenv::find_private_gpu(MPI_COMM_WORLD);
+        bind_ranks_to_numa(binding.ranks_per_numa);
+        if (dry_run_ranks) {
+            int nproc;
+            MPI_Comm_size(MPI_COMM_WORLD, &nproc);
+            if (nproc>1) throw std::runtime_error("dry-run-ranks requires a single MPI rank.");
+        }
+        auto context = dry_run_ranks? make_dry_run_context(resources): arb::make_context(resources, MPI_COMM_WORLD);
+        root = arb::rank(context) == 0;
+#else
+        resources.gpu_id = arbenv::default_gpu();
+        bind_ranks_to_numa(binding.ranks_per_numa);
+        auto context = dry_run_ranks? make_dry_run_context(resources): arb::make_context(resources);
+#endif
+
+#ifdef ARB_PROFILE_ENABLED
+        arb::profile::profiler_initialize(context);
+#endif
+
+        // All runs share the context, so that MPI and the thread pool are set up once.
+        std::vector<run_summary> summary;
+        for (auto& params: runs) {
+            if (root) {
+                std::cout << "run: " << params.name << "\n";
+            }
+            summary.push_back(run_model(params, context, counters.get()));
+        }
+        if (root && runs.size()>1) {
+            print_summary(std::cout, summary);
+        }
+    }
+    catch (std::exception& e) {
+        std::cerr << "exception caught in ring miniapp: " << e.what() << "\n";
+        return 1;
     }
 
-    std::ofstream file(fname);
-    file << std::setw(1) << json << "\n";
+    return 0;
 }
 
-// Helper used to interpolate in branch_cell.
+// Helper used to interpolate in random_morphology.
 template <typename T>
 double interp(const std::array<T,2>& r, unsigned i, unsigned n) {
     double p = i * 1./(n-1);
@@ -321,15 +912,12 @@ double interp(const std::array<T,2>& r, unsigned i, unsigned n) {
     return r[0] + p*(r1-r0);
 }
 
-arb::cable_cell complex_cell (arb::cell_gid_type gid, const cell_parameters& params) {
-    using arb::reg::tagged;
-    using arb::reg::all;
-    using arb::ls::location;
-    using arb::ls::uniform;
-    using mech = arb::mechanism_desc;
-
+// Build a random morphology, where uniform() returns the next uniformly distributed value in [0, 1).
+template <typename Uniform>
+arb::segment_tree random_morphology(const cell_parameters& params, Uniform&& uniform) {
     arb::segment_tree tree;
 
+    // Add soma.
     double soma_radius = 12.6157/2.0;
     int soma_tag = 1;
     tree.append(arb::mnpos, {0, 0,-soma_radius, soma_radius}, {0, 0, soma_radius, soma_radius}, soma_tag); // For area of 500 μm².
@@ -337,10 +925,6 @@ arb::cable_cell complex_cell (arb::cell_gid_type gid, const cell_parameters& par
     std::vector<std::vector<unsigned>> levels;
     levels.push_back({0});
 
-    // Standard mersenne_twister_engine seeded with gid.
-    std::mt19937 gen(gid);
-    std::uniform_real_distribution<double> dis(0, 1);
-
     double dend_radius = 0.5; // Diameter of 1 μm for each cable.
     int dend_tag = 3;
 
@@ -356,7 +940,7 @@ arb::cable_cell complex_cell (arb::cell_gid_type gid, const cell_parameters& par
         std::vector<unsigned> sec_ids;
         for (unsigned sec: levels[i]) {
             for (unsigned j=0; j<2; ++j) {
-                if (dis(gen)<bp) {
+                if (uniform()<bp) {
                     auto z = dist_from_soma;
                     auto dz = l/nc;
                     auto p = sec;
@@ -375,6 +959,26 @@ arb::cable_cell complex_cell (arb::cell_gid_type gid, const cell_parameters& par
         dist_from_soma += l;
     }
 
+    return tree;
+}
+
+arb::segment_tree random_morphology(arb::cell_gid_type gid, const cell_parameters& params) {
+    if (params.rng==rng_kind::mt19937) {
+        // Standard mersenne_twister_engine seeded with gid.
+        std::mt19937 gen(gid);
+        std::uniform_real_distribution<double> dis(0, 1);
+        return random_morphology(params, [&]() { return dis(gen); });
+    }
+
+    rng::sequence seq(gid, rng::morphology);
+    return random_morphology(params, [&]() { return seq.uniform01(); });
+}
+
+cell_prototype complex_prototype(const cell_parameters& params) {
+    using arb::reg::tagged;
+    using arb::reg::all;
+    using arb::ls::location;
+
     arb::label_dict dict;
 
     dict.set("soma", tagged(1));
@@ -382,9 +986,6 @@ arb::cable_cell complex_cell (arb::cell_gid_type gid, const cell_parameters& par
     dict.set("dend", tagged(3));
     dict.set("apic", tagged(4));
     dict.set("center", location(0, 0.5));
-    if (params.synapses>1) {
-       dict.set("synapses",  arb::ls::uniform(arb::reg::all(), 0, params.synapses-2, gid));
-    }
 
     auto soma = "soma"_lab;
     auto dend = "dend"_lab;
@@ -426,58 +1027,10 @@ arb::cable_cell complex_cell (arb::cell_gid_type gid, const cell_parameters& par
 
     decor.set_default(arb::cv_policy_every_segment());
 
-    return {arb::morphology(tree), dict, decor};
+    return {dict, decor};
 }
 
-arb::cable_cell branch_cell(arb::cell_gid_type gid, const cell_parameters& params) {
-    arb::segment_tree tree;
-
-    // Add soma.
-    double soma_radius = 12.6157/2.0;
-    int soma_tag = 1;
-    tree.append(arb::mnpos, {0, 0,-soma_radius, soma_radius}, {0, 0, soma_radius, soma_radius}, soma_tag); // For area of 500 μm².
-
-    std::vector<std::vector<unsigned>> levels;
-    levels.push_back({0});
-
-    // Standard mersenne_twister_engine seeded with gid.
-    std::mt19937 gen(gid);
-    std::uniform_real_distribution<double> dis(0, 1);
-
-    double dend_radius = 0.5; // Diameter of 1 μm for each cable.
-    int dend_tag = 3;
-
-    double dist_from_soma = soma_radius;
-    for (unsigned i=0; i<params.max_depth; ++i) {
-        // Branch prob at this level.
-        double bp = interp(params.branch_probs, i, params.max_depth);
-        // Length at this level.
-        double l = interp(params.lengths, i, params.max_depth);
-        // Number of compartments at this level.
-        unsigned nc = std::round(interp(params.compartments, i, params.max_depth));
-
-        std::vector<unsigned> sec_ids;
-        for (unsigned sec: levels[i]) {
-            for (unsigned j=0; j<2; ++j) {
-                if (dis(gen)<bp) {
-                    auto z = dist_from_soma;
-                    auto dz = l/nc;
-                    auto p = sec;
-                    for (unsigned k=1; k<nc; ++k) {
-                        p = tree.append(p, {0,0,z+(k+1)*dz, dend_radius}, dend_tag);
-                    }
-                    sec_ids.push_back(p);
-                }
-            }
-        }
-        if (sec_ids.empty()) {
-            break;
-        }
-        levels.push_back(sec_ids);
-
-        dist_from_soma += l;
-    }
-
+cell_prototype branch_prototype(const cell_parameters& params) {
     arb::label_dict labels;
 
     auto soma = "soma"_lab;
@@ -487,9 +1040,6 @@ arb::cable_cell branch_cell(arb::cell_gid_type gid, const cell_parameters& param
     using arb::reg::tagged;
     labels.set("soma",      tagged(1));
     labels.set("dendrites", join(tagged(3), tagged(4)));
-    if (params.synapses>1) {
-       labels.set("synapses",  arb::ls::uniform(arb::reg::all(), 0, params.synapses-2, gid));
-    }
 
     arb::decor decor;
 
@@ -511,5 +1061,23 @@ arb::cable_cell branch_cell(arb::cell_gid_type gid, const cell_parameters& param
     // Make a CV between every sample in the sample tree.
     decor.set_default(arb::cv_policy_every_segment());
 
-    return {arb::morphology(tree), labels, decor};
+    return {labels, decor};
+}
+
+arb::cable_cell make_cell(arb::cell_gid_type gid, const arb::morphology& morph, const cell_prototype& proto, const cell_parameters& params) {
+    // The only per-cell label is the locset of the unconnected synapses, which is seeded with the gid.
+    auto labels = proto.labels;
+    if (params.synapses>1) {
+       labels.set("synapses",  arb::ls::uniform(arb::reg::all(), 0, params.synapses-2, gid));
+    }
+
+    return {morph, labels, proto.decor};
+}
+
+arb::cable_cell complex_cell(arb::cell_gid_type gid, const cell_parameters& params) {
+    return make_cell(gid, arb::morphology(random_morphology(gid, params)), complex_prototype(params), params);
+}
+
+arb::cable_cell branch_cell(arb::cell_gid_type gid, const cell_parameters& params) {
+    return make_cell(gid, arb::morphology(random_morphology(gid, params)), branch_prototype(params), params);
 }
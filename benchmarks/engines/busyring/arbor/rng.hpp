@@ -0,0 +1,85 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+// Stateless counter-based random number generation for the busyring model.
+//
+// Every random value used to build the model is a pure function of a key
+// (the gid of the cell and the stream it belongs to) and a counter (e.g. the
+// index of a connection), so that any single value can be computed in O(1)
+// without generating or storing the values that come before it.
+// The generator is Philox4x32-10 (Salmon et al., SC'11).
+
+namespace rng {
+
+using counter_type = std::array<std::uint32_t, 4>;
+using key_type = std::array<std::uint32_t, 2>;
+
+// Independent streams of random values for each cell.
+enum stream: std::uint32_t {
+    connections = 0,
+    morphology = 1,
+    sampling = 2,
+    background = 3,
+};
+
+counter_type philox4x32(counter_type ctr, key_type key) {
+    constexpr std::uint32_t m0 = 0xD2511F53;
+    constexpr std::uint32_t m1 = 0xCD9E8D57;
+    constexpr std::uint32_t w0 = 0x9E3779B9;
+    constexpr std::uint32_t w1 = 0xBB67AE85;
+
+    for (unsigned r=0; r<10; ++r) {
+        std::uint64_t p0 = std::uint64_t(m0)*ctr[0];
+        std::uint64_t p1 = std::uint64_t(m1)*ctr[2];
+        ctr = {std::uint32_t(p1>>32)^ctr[1]^key[0], std::uint32_t(p1),
+               std::uint32_t(p0>>32)^ctr[3]^key[1], std::uint32_t(p0)};
+        key[0] += w0;
+        key[1] += w1;
+    }
+    return ctr;
+}
+
+// The block of four random values at index i of a stream of cell gid.
+counter_type block(std::uint32_t gid, stream s, std::uint32_t i) {
+    return philox4x32({i, 0, 0, 0}, {gid, s});
+}
+
+// Map a random 32 bit value to a double in [0, 1).
+double uniform01(std::uint32_t x) {
+    return x*0x1p-32;
+}
+
+// Map a random 32 bit value to an integer in [0, n).
+std::uint32_t uniform_int(std::uint32_t x, std::uint32_t n) {
+    return std::uint32_t((std::uint64_t(x)*n)>>32);
+}
+
+// Sequential access to the values of one stream, for algorithms that
+// consume a variable number of random values.
+class sequence {
+public:
+    sequence(std::uint32_t gid, stream s): gid_(gid), stream_(s) {}
+
+    std::uint32_t next() {
+        if (pos_==4) {
+            block_ = block(gid_, stream_, index_++);
+            pos_ = 0;
+        }
+        return block_[pos_++];
+    }
+
+    double uniform01() {
+        return rng::uniform01(next());
+    }
+
+private:
+    std::uint32_t gid_;
+    stream stream_;
+    std::uint32_t index_ = 0;
+    counter_type block_;
+    unsigned pos_ = 4;
+};
+
+} // namespace rng
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include <arbor/profile/meter_manager.hpp>
+
+// The parts of the json benchmark report (schema version 1) that the busyring
+// and exchange benchmarks share.
+
+// Summary statistics of the wall time of repeated runs.
+struct run_stats {
+    std::vector<double> times;
+
+    run_stats(std::vector<double> t): times(std::move(t)) {
+        std::sort(times.begin(), times.end());
+    }
+
+    double min() const { return times.empty()? 0: times.front(); }
+
+    double median() const {
+        auto n = times.size();
+        if (!n) return 0;
+        return n%2? times[n/2]: 0.5*(times[n/2-1]+times[n/2]);
+    }
+
+    double mean() const {
+        return times.empty()? 0: std::accumulate(times.begin(), times.end(), 0.)/times.size();
+    }
+
+    double stddev() const {
+        auto n = times.size();
+        if (n<2) return 0;
+        double m = mean(), ss = 0;
+        for (auto t: times) ss += (t-m)*(t-m);
+        return std::sqrt(ss/(n-1));
+    }
+
+    nlohmann::json to_json() const {
+        return {
+            {"min", min()},
+            {"median", median()},
+            {"mean", mean()},
+            {"stddev", stddev()},
+            {"repetitions", times.size()},
+            {"times", times}
+        };
+    }
+
+    friend std::ostream& operator<<(std::ostream& o, const run_stats& s) {
+        return o << "model-run-stats"
+                 << " min " << s.min()
+                 << " median " << s.median()
+                 << " mean " << s.mean()
+                 << " stddev " << s.stddev()
+                 << " repetitions " << s.times.size();
+    }
+};
+
+// Add the meter report to a json report, in the layout of the NEURON benchmark's
+// meters.json: a list of meters, each with one measurement per rank for each checkpoint.
+void add_meters(nlohmann::json& j, const arb::profile::meter_report& report) {
+    j["checkpoints"] = report.checkpoints;
+    j["num_domains"] = report.num_domains;
+    j["meters"] = nlohmann::json::array();
+    for (auto& m: report.meters) {
+        j["meters"].push_back({{"name", m.name}, {"units", m.units}, {"measurements", m.measurements}});
+    }
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <numeric>
+#include <vector>
+
+#include <arbor/common_types.hpp>
+#include <arbor/sampling.hpp>
+#include <arbor/util/any_ptr.hpp>
+
+#include "parameters.hpp"
+#include "rng.hpp"
+#include "trace_output.hpp"
+
+// The gids of the cells to sample, in ascending order.
+std::vector<arb::cell_gid_type> sampled_gids(const sampling_parameters& p, unsigned num_cells) {
+    std::vector<arb::cell_gid_type> gids;
+    switch (p.selection) {
+    case sample_selection::stride:
+        for (unsigned gid=0; gid<num_cells; gid+=std::max(1u, p.stride)) {
+            gids.push_back(gid);
+        }
+        break;
+    case sample_selection::random:
+        // Each cell is selected independently with probability p.fraction.
+        for (unsigned gid=0; gid<num_cells; ++gid) {
+            if (rng::uniform01(rng::block(gid, rng::sampling, 0)[0])<p.fraction) {
+                gids.push_back(gid);
+            }
+        }
+        break;
+    case sample_selection::list:
+        for (auto gid: p.gids) {
+            if (gid<num_cells) gids.push_back(gid);
+        }
+        std::sort(gids.begin(), gids.end());
+        gids.erase(std::unique(gids.begin(), gids.end()), gids.end());
+        break;
+    }
+    return gids;
+}
+
+// Sample storage with one preallocated buffer per thread, so that sampler
+// callbacks, which are called concurrently from the simulation's worker threads,
+// append to their own buffer without locking.
+//
+// The time spent in the sampler callbacks is accumulated per thread.
+class sample_pool {
+public:
+    // Reserve space for nsamples samples, spread evenly over nthreads threads.
+    sample_pool(unsigned nthreads, std::size_t nsamples):
+        buffers_(nthreads+1),
+        id_(next_id())
+    {
+        const std::size_t per_thread = nsamples/std::max(1u, nthreads) + nsamples/8 + 1;
+        for (auto& b: buffers_) {
+            b.samples.gid.reserve(per_thread);
+            b.samples.time.reserve(per_thread);
+            b.samples.voltage.reserve(per_thread);
+        }
+    }
+
+    arb::sampler_function sampler() {
+        return [this](arb::probe_metadata pm, std::size_t n, const arb::sample_record* recs) {
+            auto t0 = std::chrono::steady_clock::now();
+            auto& b = local_buffer();
+            std::unique_lock<std::mutex> lock(spill_mutex_, std::defer_lock);
+            if (&b==&buffers_.back()) lock.lock();
+
+            for (std::size_t i=0; i<n; ++i) {
+                b.samples.gid.push_back(pm.id.gid);
+                b.samples.time.push_back(recs[i].time);
+                b.samples.voltage.push_back(*arb::util::any_cast<const double*>(recs[i].data));
+            }
+            b.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+        };
+    }
+
+    std::size_t size() const {
+        std::size_t n = 0;
+        for (auto& b: buffers_) n += b.samples.time.size();
+        return n;
+    }
+
+    // Total time spent in sampler callbacks, summed over threads.
+    double total_seconds() const {
+        double t = 0;
+        for (auto& b: buffers_) t += b.seconds;
+        return t;
+    }
+
+    // Longest time spent in sampler callbacks by any one thread.
+    double max_seconds() const {
+        double t = 0;
+        for (auto& b: buffers_) t = std::max(t, b.seconds);
+        return t;
+    }
+
+    // All samples, ordered by gid then time.
+    trace_columns collect() const {
+        trace_columns all;
+        for (auto& b: buffers_) {
+            all.gid.insert(all.gid.end(), b.samples.gid.begin(), b.samples.gid.end());
+            all.time.insert(all.time.end(), b.samples.time.begin(), b.samples.time.end());
+            all.voltage.insert(all.voltage.end(), b.samples.voltage.begin(), b.samples.voltage.end());
+        }
+
+        std::vector<std::size_t> order(all.time.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&all](auto l, auto r) {
+            return all.gid[l]<all.gid[r] || (all.gid[l]==all.gid[r] && all.time[l]<all.time[r]);
+        });
+
+        trace_columns sorted;
+        sorted.gid.reserve(order.size());
+        sorted.time.reserve(order.size());
+        sorted.voltage.reserve(order.size());
+        for (auto i: order) {
+            sorted.gid.push_back(all.gid[i]);
+            sorted.time.push_back(all.time[i]);
+            sorted.voltage.push_back(all.voltage[i]);
+        }
+        return sorted;
+    }
+
+private:
+    struct buffer {
+        trace_columns samples;
+        double seconds = 0;
+    };
+
+    // Each thread claims a buffer the first time it samples. The last buffer is
+    // shared, under a lock, by any threads beyond the expected number.
+    buffer& local_buffer() {
+        thread_local std::uint64_t owner = 0;
+        thread_local buffer* local = nullptr;
+        if (owner!=id_) {
+            auto i = std::min<std::size_t>(next_++, buffers_.size()-1);
+            owner = id_;
+            local = &buffers_[i];
+        }
+        return *local;
+    }
+
+    // Unique non-zero id of each pool, used to identify the pool that a thread's buffer belongs to.
+    static std::uint64_t next_id() {
+        static std::atomic<std::uint64_t> id{0};
+        return ++id;
+    }
+
+    std::vector<buffer> buffers_;
+    std::uint64_t id_;
+    std::atomic<std::size_t> next_{0};
+    std::mutex spill_mutex_;
+};
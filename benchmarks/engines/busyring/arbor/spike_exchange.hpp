@@ -0,0 +1,256 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <numeric>
+#include <stdexcept>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include <arbor/context.hpp>
+#include <arbor/domain_decomposition.hpp>
+#include <arbor/spike.hpp>
+
+#ifdef ARB_MPI_ENABLED
+#include <mpi.h>
+#endif
+
+#include "decomposition.hpp"
+
+// Spikes generated and received by each rank in each epoch of a run, and the bytes
+// that the spike exchange moves between ranks.
+//
+// Arbor exchanges the spikes of an epoch with an all-gather, so that every rank
+// receives the spikes of every other rank. Of those, a rank only needs the spikes
+// whose source has a connection onto one of its cells, which are counted with the
+// fan-out of each source onto the local cells (see local_fanout).
+//
+// The local spike callback, with the spikes generated on this rank, and the global
+// spike callback, with the spikes of all ranks, are each called once per exchange,
+// so each call is one epoch. The buffers are allocated for the expected number of
+// epochs before the run, so that recording an epoch doesn't allocate.
+class spike_exchange {
+public:
+    // fanout[gid] is the number of connections from gid onto local cells, which
+    // must outlive the spike_exchange.
+    spike_exchange(std::size_t expected_epochs, const std::vector<std::uint32_t>& fanout, const arb::domain_decomposition& d):
+        fanout_(fanout), local_(fanout.size(), 0)
+    {
+        for (auto& g: d.groups()) {
+            for (auto gid: g.gids) local_[gid] = 1;
+        }
+        generated_.reserve(expected_epochs);
+        gathered_.reserve(expected_epochs);
+        needed_.reserve(expected_epochs);
+        events_.reserve(expected_epochs);
+    }
+
+    // Called from the local spike callback.
+    void generated(const std::vector<arb::spike>& spikes) {
+        generated_.push_back(spikes.size());
+    }
+
+    // Called from the global spike callback. Returns the events of the spikes for
+    // the local cells, as fanout_events does, so that the spikes are only scanned once.
+    std::uint64_t gathered(const std::vector<arb::spike>& spikes) {
+        std::uint64_t needed = 0, events = 0;
+        for (auto& s: spikes) {
+            const auto n = fanout_[s.source.gid];
+            events += n;
+            if (n && !local_[s.source.gid]) ++needed;
+        }
+        gathered_.push_back(spikes.size());
+        needed_.push_back(needed);
+        events_.push_back(events);
+        return events;
+    }
+
+    // The exchange of all ranks. The per-rank counts are those of each process,
+    // which in a dry run is the one simulated rank.
+    struct summary {
+        static constexpr std::size_t spike_bytes = sizeof(arb::spike);
+
+        unsigned ranks = 1;
+        std::size_t epochs = 0;
+
+        // Counts of each process in each epoch, with the epochs of a process contiguous.
+        std::vector<std::uint64_t> generated;       // Spikes generated by the cells of the rank.
+        std::vector<std::uint64_t> received;        // Spikes of other ranks received by the rank.
+        std::vector<std::uint64_t> needed;          // Received spikes with a connection onto the rank.
+        std::vector<std::uint64_t> events;          // Events generated for the cells of the rank.
+
+        // Totals of each rank over the run.
+        std::vector<std::uint64_t> rank_generated;
+        std::vector<std::uint64_t> rank_received;
+        std::vector<std::uint64_t> rank_needed;
+        std::vector<std::uint64_t> rank_events;
+
+        // Totals over ranks of each epoch.
+        std::vector<std::uint64_t> epoch_spikes;    // Spikes generated by all ranks.
+        std::vector<std::uint64_t> epoch_max;       // Spikes generated by the busiest rank.
+
+        // Bytes of spikes sent by a rank, which go to every other rank, and received.
+        std::uint64_t bytes_sent(unsigned i) const { return rank_generated[i]*(ranks-1)*spike_bytes; }
+        std::uint64_t bytes_received(unsigned i) const { return rank_received[i]*spike_bytes; }
+
+        // Bytes of spikes moved between ranks in an epoch.
+        std::uint64_t epoch_bytes(std::size_t e) const { return epoch_spikes[e]*(ranks-1)*spike_bytes; }
+
+        std::uint64_t spikes() const {
+            return std::accumulate(epoch_spikes.begin(), epoch_spikes.end(), std::uint64_t(0));
+        }
+
+        std::uint64_t bytes() const {
+            return spikes()*(ranks-1)*spike_bytes;
+        }
+
+        // The ratio of the most spikes generated by one rank to the mean over ranks,
+        // over the run, and the mean and largest over epochs with spikes.
+        double rank_imbalance() const {
+            const double mean = double(spikes())/ranks;
+            if (rank_generated.empty() || mean<=0) return 1;
+            return *std::max_element(rank_generated.begin(), rank_generated.end())/mean;
+        }
+
+        std::pair<double, double> epoch_imbalance() const {
+            double sum = 0, max = 1;
+            std::size_t n = 0;
+            for (std::size_t e=0; e<epochs; ++e) {
+                if (!epoch_spikes[e]) continue;
+                const double x = epoch_max[e]*double(ranks)/epoch_spikes[e];
+                sum += x;
+                max = std::max(max, x);
+                ++n;
+            }
+            return {n? sum/n: 1, max};
+        }
+
+        // The fraction of the received spikes that were needed.
+        double needed_fraction() const {
+            const double received = std::accumulate(rank_received.begin(), rank_received.end(), 0.);
+            const double needed = std::accumulate(rank_needed.begin(), rank_needed.end(), 0.);
+            return received>0? needed/received: 0;
+        }
+
+        nlohmann::json to_json() const {
+            auto [epoch_mean, epoch_max_imbalance] = epoch_imbalance();
+            nlohmann::json j = {
+                {"ranks", ranks},
+                {"epochs", epochs},
+                {"spikes", spikes()},
+                {"bytes", bytes()},
+                {"spike-bytes", spike_bytes},
+                {"needed-fraction", needed_fraction()},
+                {"imbalance", {
+                    {"ranks", rank_imbalance()},
+                    {"epoch-mean", epoch_mean},
+                    {"epoch-max", epoch_max_imbalance}}}
+            };
+            auto& jr = j["per-rank"];
+            jr["generated"] = rank_generated;
+            jr["received"] = rank_received;
+            jr["needed"] = rank_needed;
+            jr["events"] = rank_events;
+            for (unsigned i=0; i<rank_generated.size(); ++i) {
+                jr["bytes-sent"].push_back(bytes_sent(i));
+                jr["bytes-received"].push_back(bytes_received(i));
+            }
+            auto& je = j["per-epoch"];
+            je["spikes"] = epoch_spikes;
+            je["rank-max"] = epoch_max;
+            for (std::size_t e=0; e<epochs; ++e) je["bytes"].push_back(epoch_bytes(e));
+            return j;
+        }
+
+        friend std::ostream& operator<<(std::ostream& o, const summary& s) {
+            auto [epoch_mean, epoch_max_imbalance] = s.epoch_imbalance();
+            const double mb = s.bytes()*1e-6;
+            return o << "spike-exchange: " << s.spikes() << " spikes; "
+                     << mb << " MB between ranks, " << (s.epochs? mb/s.epochs: 0) << " MB per epoch; "
+                     << "imbalance ranks " << s.rank_imbalance()
+                     << " epoch mean " << epoch_mean << " max " << epoch_max_imbalance << "; "
+                     << "needed " << s.needed_fraction();
+        }
+    };
+
+    // Collective: the summary of all ranks, which is valid on the root rank.
+    summary reduce(const arb::context& ctx) const {
+        summary s;
+        s.ranks = arb::num_ranks(ctx);
+        s.epochs = generated_.size();
+        const unsigned copies = ranks_per_process(s.ranks);
+        const unsigned nproc = s.ranks/copies;
+
+        // Every rank takes part in every exchange, so all have the same number of epochs.
+        unsigned long epochs[2] = {std::min(generated_.size(), gathered_.size()), std::max(generated_.size(), gathered_.size())};
+#ifdef ARB_MPI_ENABLED
+        MPI_Allreduce(MPI_IN_PLACE, epochs, 1, MPI_UNSIGNED_LONG, MPI_MIN, MPI_COMM_WORLD);
+        MPI_Allreduce(MPI_IN_PLACE, epochs+1, 1, MPI_UNSIGNED_LONG, MPI_MAX, MPI_COMM_WORLD);
+#endif
+        if (epochs[0]!=epochs[1]) {
+            throw std::runtime_error("spike exchange: the ranks recorded different numbers of epochs.");
+        }
+
+        std::vector<std::uint64_t> received(s.epochs);
+        for (std::size_t e=0; e<s.epochs; ++e) received[e] = gathered_[e]-generated_[e];
+
+        auto gather = [&](const std::vector<std::uint64_t>& local) {
+#ifdef ARB_MPI_ENABLED
+            std::vector<std::uint64_t> all(nproc*s.epochs);
+            MPI_Gather(local.data(), int(s.epochs), MPI_UINT64_T, all.data(), int(s.epochs), MPI_UINT64_T, 0, MPI_COMM_WORLD);
+            return all;
+#else
+            return local;
+#endif
+        };
+        s.generated = gather(generated_);
+        s.received = gather(received);
+        s.needed = gather(needed_);
+        s.events = gather(events_);
+
+        auto total = [&s](const std::vector<std::uint64_t>& v, unsigned i) {
+            auto first = v.begin()+i*s.epochs;
+            return std::accumulate(first, first+s.epochs, std::uint64_t(0));
+        };
+        s.epoch_spikes.assign(s.epochs, 0);
+        s.epoch_max.assign(s.epochs, 0);
+        for (unsigned i=0; i<nproc; ++i) {
+            s.rank_generated.push_back(total(s.generated, i));
+            s.rank_received.push_back(total(s.received, i));
+            s.rank_needed.push_back(total(s.needed, i));
+            s.rank_events.push_back(total(s.events, i));
+            for (std::size_t e=0; e<s.epochs; ++e) {
+                const auto x = s.generated[i*s.epochs+e];
+                s.epoch_spikes[e] += x*copies;
+                s.epoch_max[e] = std::max(s.epoch_max[e], x);
+            }
+        }
+        return s;
+    }
+
+private:
+    const std::vector<std::uint32_t>& fanout_;
+    std::vector<char> local_;                   // Whether each gid is on this rank.
+
+    std::vector<std::uint64_t> generated_;      // Spikes generated on this rank in each epoch.
+    std::vector<std::uint64_t> gathered_;       // Spikes of all ranks in each epoch.
+    std::vector<std::uint64_t> needed_;         // Spikes of other ranks with connections onto this rank.
+    std::vector<std::uint64_t> events_;         // Events generated for the local cells in each epoch.
+};
+
+// Writes the counts of each rank in each epoch with one line per rank and epoch:
+//
+//   rank,epoch,generated,received,needed,events
+void write_exchange_csv(const std::string& fname, const spike_exchange::summary& s) {
+    std::ofstream file(fname);
+    file << "rank,epoch,generated,received,needed,events\n";
+    for (std::size_t i=0; i<s.generated.size(); ++i) {
+        file << i/s.epochs << ',' << i%s.epochs << ',' << s.generated[i] << ',' << s.received[i] << ','
+             << s.needed[i] << ',' << s.events[i] << '\n';
+    }
+}
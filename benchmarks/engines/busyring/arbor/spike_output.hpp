@@ -0,0 +1,257 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arbor/spike.hpp>
+
+#ifdef ARB_MPI_ENABLED
+#include <mpi.h>
+#endif
+
+#include "parameters.hpp"
+
+// File name extension for each spike format.
+std::string spike_file_extension(spike_format format) {
+    return format==spike_format::gdf? "gdf": "bin";
+}
+
+// Sort spikes by time, with ties broken by gid.
+void sort_spikes(std::vector<arb::spike>& spikes) {
+    std::sort(spikes.begin(), spikes.end(),
+        [](const arb::spike& l, const arb::spike& r) {
+            return l.time<r.time || (l.time==r.time && l.source.gid<r.source.gid);
+        });
+}
+
+template <typename T>
+void pack_bytes(T value, std::vector<char>& buf) {
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    buf.insert(buf.end(), bytes, bytes+sizeof(T));
+}
+
+// Append spikes, formatted for output, to buf.
+void format_spikes(const std::vector<arb::spike>& spikes, spike_format format, std::vector<char>& buf) {
+    switch (format) {
+    case spike_format::gdf: {
+        char linebuf[45];
+        for (auto& spike: spikes) {
+            auto n = std::snprintf(
+                linebuf, sizeof(linebuf), "%u %.4f\n",
+                unsigned{spike.source.gid}, float(spike.time));
+            buf.insert(buf.end(), linebuf, linebuf+n);
+        }
+        break;
+    }
+    case spike_format::bin32:
+        for (auto& spike: spikes) {
+            pack_bytes(std::uint32_t(spike.source.gid), buf);
+            pack_bytes(float(spike.time), buf);
+        }
+        break;
+    case spike_format::bin64:
+        for (auto& spike: spikes) {
+            pack_bytes(std::uint32_t(spike.source.gid), buf);
+            pack_bytes(double(spike.time), buf);
+        }
+        break;
+    case spike_format::stats:
+        // Statistics are accumulated by spike_stats, not written spike by spike.
+        break;
+    }
+}
+
+// Writes spikes to file on a dedicated I/O thread while the simulation runs.
+//
+// Spikes are appended to a front buffer by the spike callback. When the front
+// buffer is full it is swapped with the back buffer, which the I/O thread
+// formats and writes to disk, so that the simulation only waits on I/O if the
+// previous buffer has not been written by the time the next one is full.
+//
+// Sorted output relies on the spike callback being called once per epoch with
+// the spikes of that epoch, so that sorting each buffer sorts the whole file.
+class spike_writer {
+public:
+    spike_writer(const std::string& fname, spike_format format, bool sorted, std::size_t capacity):
+        file_(fname, format==spike_format::gdf? std::ios::out: std::ios::out|std::ios::binary),
+        format_(format),
+        sorted_(sorted),
+        capacity_(std::max<std::size_t>(capacity, 1))
+    {
+        if (file_.good()) {
+            front_.reserve(capacity_);
+            back_.reserve(capacity_);
+            io_thread_ = std::thread([this]() { drain(); });
+        }
+    }
+
+    ~spike_writer() {
+        close();
+    }
+
+    bool good() const {
+        return file_.good();
+    }
+
+    std::size_t num_written() const {
+        return num_written_;
+    }
+
+    // Called from the spike callback.
+    void append(const std::vector<arb::spike>& spikes) {
+        front_.insert(front_.end(), spikes.begin(), spikes.end());
+        if (front_.size()>=capacity_) {
+            flush();
+        }
+    }
+
+    // Write any buffered spikes, and wait for the I/O thread to finish.
+    void close() {
+        if (!io_thread_.joinable()) return;
+
+        if (!front_.empty()) {
+            flush();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+        }
+        cv_.notify_all();
+        io_thread_.join();
+        file_.close();
+    }
+
+private:
+    // Hand the front buffer to the I/O thread.
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return !pending_; });
+        std::swap(front_, back_);
+        pending_ = true;
+        lock.unlock();
+        cv_.notify_all();
+    }
+
+    // Main loop of the I/O thread.
+    void drain() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this]() { return pending_ || done_; });
+            if (!pending_) break;
+
+            lock.unlock();
+            write(back_);
+            back_.clear();
+            lock.lock();
+
+            pending_ = false;
+            cv_.notify_all();
+        }
+    }
+
+    void write(std::vector<arb::spike>& spikes) {
+        if (sorted_) {
+            sort_spikes(spikes);
+        }
+
+        buf_.clear();
+        format_spikes(spikes, format_, buf_);
+        file_.write(buf_.data(), buf_.size());
+        num_written_ += spikes.size();
+    }
+
+    std::ofstream file_;
+    spike_format format_;
+    bool sorted_;
+    std::size_t capacity_;
+
+    std::vector<arb::spike> front_;     // Filled by the spike callback.
+    std::vector<arb::spike> back_;      // Written by the I/O thread.
+    std::vector<char> buf_;             // Formatted output of the I/O thread.
+    std::size_t num_written_ = 0;
+
+    bool pending_ = false;              // The back buffer is waiting to be written.
+    bool done_ = false;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread io_thread_;
+};
+
+#ifdef ARB_MPI_ENABLED
+// Writes the spikes of every rank to a single file with collective MPI-IO.
+//
+// Each rank keeps only the formatted output of its own spikes, and the shards
+// are written at the end of the run at offsets given by a prefix sum of their
+// sizes. The file is ordered by rank: use merge_spikes.py to sort it by time.
+class mpiio_spike_writer {
+public:
+    mpiio_spike_writer(spike_format format, bool sorted):
+        format_(format), sorted_(sorted)
+    {}
+
+    std::size_t num_written() const {
+        return num_written_;
+    }
+
+    // Called from the local spike callback.
+    void append(const std::vector<arb::spike>& spikes) {
+        if (sorted_) {
+            std::vector<arb::spike> tmp(spikes);
+            sort_spikes(tmp);
+            format_spikes(tmp, format_, buf_);
+        }
+        else {
+            format_spikes(spikes, format_, buf_);
+        }
+        num_written_ += spikes.size();
+    }
+
+    // Collective: must be called on all ranks. Returns false if the file could not be opened.
+    bool write(const std::string& fname, MPI_Comm comm) {
+        MPI_File fh;
+        if (MPI_File_open(comm, fname.c_str(), MPI_MODE_CREATE|MPI_MODE_WRONLY, MPI_INFO_NULL, &fh)!=MPI_SUCCESS) {
+            return false;
+        }
+        MPI_File_set_size(fh, 0);
+
+        unsigned long long size = buf_.size();
+        unsigned long long offset = 0;
+        MPI_Exscan(&size, &offset, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+        int rank;
+        MPI_Comm_rank(comm, &rank);
+        if (rank==0) offset = 0;
+
+        // Write in chunks that fit in an int count, with the same number of
+        // collective calls on every rank.
+        const unsigned long long chunk = 1ull<<30;
+        unsigned long long nchunk = (size+chunk-1)/chunk;
+        unsigned long long max_nchunk;
+        MPI_Allreduce(&nchunk, &max_nchunk, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, comm);
+        for (unsigned long long i=0; i<max_nchunk; ++i) {
+            auto b = std::min(i*chunk, size);
+            auto n = std::min(chunk, size-b);
+            MPI_File_write_at_all(fh, MPI_Offset(offset+b), buf_.data()+b, int(n), MPI_CHAR, MPI_STATUS_IGNORE);
+        }
+        MPI_File_close(&fh);
+
+        buf_.clear();
+        buf_.shrink_to_fit();
+        return true;
+    }
+
+private:
+    spike_format format_;
+    bool sorted_;
+    std::vector<char> buf_;
+    std::size_t num_written_ = 0;
+};
+#endif
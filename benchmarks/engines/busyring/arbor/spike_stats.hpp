@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include <arbor/spike.hpp>
+
+#ifdef ARB_MPI_ENABLED
+#include <mpi.h>
+#endif
+
+// Running mean and variance, with Welford's update, and Chan's formula to
+// combine the partial results of different ranks.
+struct welford {
+    double n = 0;
+    double mean = 0;
+    double m2 = 0;
+
+    void add(double x) {
+        n += 1;
+        double d = x-mean;
+        mean += d/n;
+        m2 += d*(x-mean);
+    }
+
+    void merge(const welford& o) {
+        if (o.n==0) return;
+        double nt = n+o.n;
+        double d = o.mean-mean;
+        mean += d*o.n/nt;
+        m2 += o.m2 + d*d*n*o.n/nt;
+        n = nt;
+    }
+
+    double variance() const {
+        return n>1? m2/(n-1): 0;
+    }
+};
+
+// Online spike statistics, updated in the local spike callback, that use memory
+// proportional to the number of cells, independent of the duration of the run.
+//
+// Statistics are accumulated per rank, and combined on the root rank by reduce().
+// Only the spikes of simulated_cells cells are counted: all of the cells, or in a
+// dry run the cells of the one rank that is simulated.
+class spike_stats {
+public:
+    spike_stats(unsigned num_cells, unsigned ring_size, unsigned simulated_cells):
+        ring_size_(ring_size),
+        simulated_cells_(simulated_cells),
+        counts_(num_cells, 0),
+        last_(num_cells, -1),
+        first_(ring_size? (num_cells+ring_size-1)/ring_size: 0, inf)
+    {}
+
+    // Called from the local spike callback.
+    void append(const std::vector<arb::spike>& spikes) {
+        // Spikes of a cell are processed in time order, so that intervals are positive.
+        sorted_.assign(spikes.begin(), spikes.end());
+        std::sort(sorted_.begin(), sorted_.end(),
+            [](const arb::spike& l, const arb::spike& r) { return l.time<r.time; });
+
+        for (auto& s: sorted_) {
+            auto gid = s.source.gid;
+            auto t = s.time;
+            ++counts_[gid];
+            if (last_[gid]>=0) {
+                double isi = t-last_[gid];
+                isi_.add(isi);
+                isi_min_ = std::min(isi_min_, isi);
+                isi_max_ = std::max(isi_max_, isi);
+            }
+            last_[gid] = t;
+            auto& first = first_[gid/ring_size_];
+            first = std::min(first, t);
+        }
+    }
+
+    // Collective: combine the statistics of all ranks on the root rank.
+    void reduce() {
+#ifdef ARB_MPI_ENABLED
+        int rank, nranks;
+        MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+        MPI_Comm_size(MPI_COMM_WORLD, &nranks);
+        const bool root = rank==0;
+
+        auto reduce_vec = [root](auto& v, MPI_Datatype type, MPI_Op op) {
+            MPI_Reduce(root? MPI_IN_PLACE: v.data(), v.data(), int(v.size()), type, op, 0, MPI_COMM_WORLD);
+        };
+        reduce_vec(counts_, MPI_UINT32_T, MPI_SUM);
+        reduce_vec(first_, MPI_DOUBLE, MPI_MIN);
+
+        std::vector<double> isi = {isi_.n, isi_.mean, isi_.m2, isi_min_, isi_max_};
+        std::vector<double> all(root? 5*nranks: 0);
+        MPI_Gather(isi.data(), 5, MPI_DOUBLE, all.data(), 5, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+        if (root) {
+            isi_ = welford{};
+            for (int i=0; i<nranks; ++i) {
+                const double* p = all.data()+5*i;
+                isi_.merge(welford{p[0], p[1], p[2]});
+                isi_min_ = std::min(isi_min_, p[3]);
+                isi_max_ = std::max(isi_max_, p[4]);
+            }
+        }
+#endif
+    }
+
+    std::uint64_t num_spikes() const {
+        std::uint64_t n = 0;
+        for (auto c: counts_) n += c;
+        return n;
+    }
+
+    unsigned num_active_cells() const {
+        return std::count_if(counts_.begin(), counts_.end(), [](auto c) { return c>0; });
+    }
+
+    // Mean firing rate per simulated cell in Hz, for a run of duration ms.
+    double mean_rate(double duration) const {
+        return !simulated_cells_ || duration<=0? 0: 1000.*num_spikes()/(simulated_cells_*duration);
+    }
+
+    nlohmann::json to_json(double duration) const {
+        nlohmann::json j;
+        j["spikes"] = num_spikes();
+        j["active-cells"] = num_active_cells();
+        j["simulated-cells"] = simulated_cells_;
+        j["mean-rate-hz"] = mean_rate(duration);
+        j["isi"]["count"] = isi_.n;
+        j["isi"]["mean"] = isi_.mean;
+        j["isi"]["stddev"] = std::sqrt(isi_.variance());
+        j["isi"]["min"] = isi_.n? isi_min_: 0;
+        j["isi"]["max"] = isi_.n? isi_max_: 0;
+        // Rings in which no cell spiked have first spike time -1.
+        auto& first = j["ring-first-spike"];
+        first = nlohmann::json::array();
+        for (auto t: first_) first.push_back(t==inf? -1: t);
+        j["cell-counts"] = counts_;
+        return j;
+    }
+
+    friend std::ostream& operator<<(std::ostream& o, const spike_stats& s) {
+        return o << "spike stats: "
+                 << s.num_spikes() << " spikes; "
+                 << s.num_active_cells() << " active cells; "
+                 << "isi mean " << s.isi_.mean << " ms; "
+                 << "isi stddev " << std::sqrt(s.isi_.variance()) << " ms; ";
+    }
+
+private:
+    static constexpr double inf = std::numeric_limits<double>::infinity();
+
+    unsigned ring_size_;
+    unsigned simulated_cells_;
+    std::vector<std::uint32_t> counts_;     // Number of spikes of each cell.
+    std::vector<double> last_;              // Time of the last spike of each cell, -1 if none.
+    std::vector<double> first_;             // Time of the first spike in each ring.
+    welford isi_;
+    double isi_min_ = inf;
+    double isi_max_ = 0;
+    std::vector<arb::spike> sorted_;        // Scratch space for the current batch of spikes.
+};
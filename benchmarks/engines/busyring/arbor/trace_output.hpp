@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#ifdef BUSYRING_WITH_NETCDF
+#include <netcdf_wrap.h>
+#endif
+
+#include "parameters.hpp"
+
+// Voltage samples of one or more cells stored as columns, which the samplers
+// append to directly, so that the columns can be written to file without reformatting.
+struct trace_columns {
+    std::vector<std::uint32_t> gid;
+    std::vector<double> time;
+    std::vector<double> voltage;
+};
+
+// File name extension for each trace format.
+std::string trace_file_extension(trace_format format) {
+    switch (format) {
+    case trace_format::binary: return "bin";
+    case trace_format::netcdf: return "nc";
+    default:                   return "json";
+    }
+}
+
+// Writes voltage trace as a json file.
+void write_trace_json(const std::string& fname, const trace_columns& trace) {
+    nlohmann::json json;
+    json["name"] = "ring demo";
+    json["units"] = "mV";
+    json["probe"] = "0";
+    json["data"]["gid"] = trace.gid;
+    json["data"]["time"] = trace.time;
+    json["data"]["voltage"] = trace.voltage;
+
+    std::ofstream file(fname);
+    file << std::setw(1) << json << "\n";
+}
+
+// Writes voltage trace as raw little-endian columns with a small header:
+//
+//   char[8]    magic "NSTRACE1"
+//   uint64     number of samples n
+//   uint32     number of columns m
+//   m x {char[16] name, char[8] units, char[8] type}, zero padded
+//   m x column data: n values of the column's type, "uint32" or "float64"
+//
+// The columns are gid, time and voltage.
+void write_trace_binary(const std::string& fname, const trace_columns& trace) {
+    std::ofstream file(fname, std::ios::out|std::ios::binary);
+
+    auto put = [&file](const auto& v) {
+        file.write(reinterpret_cast<const char*>(&v), sizeof(v));
+    };
+    auto put_str = [&file](const char* s, std::size_t width) {
+        std::vector<char> buf(width, 0);
+        std::strncpy(buf.data(), s, width);
+        file.write(buf.data(), width);
+    };
+
+    file.write("NSTRACE1", 8);
+    put(std::uint64_t(trace.time.size()));
+    put(std::uint32_t(3));
+    put_str("gid", 16);     put_str("", 8);   put_str("uint32", 8);
+    put_str("time", 16);    put_str("ms", 8); put_str("float64", 8);
+    put_str("voltage", 16); put_str("mV", 8); put_str("float64", 8);
+    file.write(reinterpret_cast<const char*>(trace.gid.data()), trace.gid.size()*sizeof(std::uint32_t));
+    file.write(reinterpret_cast<const char*>(trace.time.data()), trace.time.size()*sizeof(double));
+    file.write(reinterpret_cast<const char*>(trace.voltage.data()), trace.voltage.size()*sizeof(double));
+}
+
+#ifdef BUSYRING_WITH_NETCDF
+// Writes voltage trace as NetCDF, with the same variables and units as the
+// validation outputs, and an additional gid variable over the sample dimension.
+void write_trace_netcdf(const std::string& fname, const trace_columns& trace) {
+    int ncid;
+    nc_check(nc_create, fname.c_str(), 0, &ncid);
+
+    int sample_dimid, gidid, timeid, varid;
+    nc_check(nc_def_dim, ncid, "sample", trace.time.size(), &sample_dimid);
+    nc_check(nc_def_var, ncid, "gid", NC_INT, 1, &sample_dimid, &gidid);
+    nc_check(nc_def_var, ncid, "time", NC_DOUBLE, 1, &sample_dimid, &timeid);
+    nc_check(nc_def_var, ncid, "voltage", NC_DOUBLE, 1, &sample_dimid, &varid);
+
+    auto nc_put_att_cstr = [](int ncid, int varid, const char* name, const char* value) {
+        nc_check(nc_put_att_text, ncid, varid, name, std::strlen(value), value);
+    };
+
+    nc_put_att_cstr(ncid, timeid, "units", "ms");
+    nc_put_att_cstr(ncid, varid, "units", "mV");
+    nc_put_att_cstr(ncid, NC_GLOBAL, "model", "busyring");
+    nc_put_att_cstr(ncid, NC_GLOBAL, "simulator", "arbor");
+
+    nc_check(nc_enddef, ncid);
+
+    std::vector<int> gid(trace.gid.begin(), trace.gid.end());
+    nc_check(nc_put_var_int, ncid, gidid, gid.data());
+    nc_check(nc_put_var_double, ncid, timeid, trace.time.data());
+    nc_check(nc_put_var_double, ncid, varid, trace.voltage.data());
+    nc_check(nc_close, ncid);
+}
+#endif
+
+void write_trace(const std::string& fname, trace_format format, const trace_columns& trace) {
+    switch (format) {
+    case trace_format::json:
+        write_trace_json(fname, trace);
+        break;
+    case trace_format::binary:
+        write_trace_binary(fname, trace);
+        break;
+    case trace_format::netcdf:
+#ifdef BUSYRING_WITH_NETCDF
+        write_trace_netcdf(fname, trace);
+#else
+        throw std::runtime_error("NetCDF trace output requires busyring to be built with NetCDF.");
+#endif
+        break;
+    }
+}
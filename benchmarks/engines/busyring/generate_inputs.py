@@ -40,6 +40,23 @@ synapses = conf_dat['synapses']       # depth of cell
 cb = range(conf_dat['min-cells'], conf_dat['max-cells']+1)
 cell_range=[pow(2,x) for x in cb]
 duration=200                    # simulation duration (ms)
+# Optional engine parameters that are forwarded verbatim to the input
+# file of each run when they are set in the model configuration.
+optional_keys = ['prototype-cache', 'unique-morphologies', 'rng',
+                 'spike-output', 'spike-gather', 'spike-sort', 'spike-buffer',
+                 'record', 'trace-format', 'sample-selection', 'sample-stride',
+                 'sample-fraction', 'sample-gids', 'sample-interval',
+                 'warmup', 'repetitions', 'rebuild', 'perf-counters',
+                 'cpu-group-size', 'gpu-group-size', 'prefer-gpu', 'decomposition',
+                 'source-locality', 'source-window',
+                 'random-weight', 'background-rate', 'background-weight', 'background-targets',
+                 'connectivity', 'rewire-prob', 'distance-sigma', 'distance-delay', 'powerlaw-exponent',
+                 'bind-threads', 'bind-procs', 'ranks-per-numa', 'epoch-series',
+                 'dry-run-ranks', 'spike-exchange', 'cross-rank-stats']
+# If ensemble is set in the model configuration, arbor runs all of the model
+# sizes in one process, from a single input file with a list of configurations.
+ensemble = conf_dat.get('ensemble', False)
+ensemble_runs = []
 
 # find the current directory
 
@@ -111,6 +128,9 @@ for ncells in cell_range:
         'compartments': [20, 2],
         'lengths': [200, 20],
         }
+    for key in optional_keys:
+        if key in conf_dat:
+            d[key] = conf_dat[key]
 
     fname = idir+'/'+run_name+'.json'
     pfid = open(fname, 'w')
@@ -136,9 +156,27 @@ for ncells in cell_range:
     cnr_run_fid.write('  echo "    %d:   run neuron to generate model input %s"\n'%(ncells, cnrn_input_path))
     cnr_run_fid.write('fi\n')
 
-    arb_run_fid.write('arb_ofile="$odir/%s".out\n'%(run_name))
-    arb_run_fid.write('run_with_mpi arbor-busyring "%s" "$odir" > $arb_ofile\n'%(fname))
-    arb_run_fid.write('table_line $arb_ofile\n')
+    if ensemble:
+        ensemble_runs.append(d)
+    else:
+        arb_run_fid.write('arb_ofile="$odir/%s".out\n'%(run_name))
+        arb_run_fid.write('run_with_mpi arbor-busyring --report=json "%s" "$odir" > $arb_ofile\n'%(fname))
+        arb_run_fid.write('table_line $arb_ofile\n')
+
+if ensemble:
+    fname = idir+'/run_ensemble_%d.json'%(depth)
+    pfid = open(fname, 'w')
+    pfid.write(json.dumps(ensemble_runs, indent=4))
+    pfid.close()
+
+    # Split the output at the "run: <name>" line printed before each run,
+    # into the same per-run output files as separate launches would produce,
+    # and drop the summary of the runs printed at the end.
+    arb_run_fid.write('arb_log="$odir/ensemble_%d.log"\n'%(depth))
+    arb_run_fid.write('run_with_mpi arbor-busyring --report=json "%s" "$odir" > "$arb_log"\n'%(fname))
+    arb_run_fid.write('awk -v odir="$odir" \'/^run: / {f=odir "/" $2 ".out"; next} /^summary of / {f=""} f {print > f}\' "$arb_log"\n')
+    for d in ensemble_runs:
+        arb_run_fid.write('table_line "$odir/%s".out\n'%(d['name']))
 
 nrn_run_fid.write('echo\n')
 cnr_run_fid.write('echo\n')
@@ -0,0 +1,74 @@
+import argparse
+import heapq
+import struct
+
+# Merge spike output written by arbor-busyring into a single file sorted by time.
+#
+# The inputs are either the per-rank shards written with "spike-gather": "rank-files",
+# or the single rank-ordered file written with "spike-gather": "mpi-io".
+# If every input is already sorted by time ("spike-sort": true with "rank-files"),
+# use --presorted to merge the inputs as streams without loading them into memory.
+
+def parse_clargs():
+    P = argparse.ArgumentParser(description='Merge busyring spike files into one time-sorted file.')
+    P.add_argument('inputs', type=str, nargs='+',
+                   help='spike files to merge.')
+    P.add_argument('-o', '--output', type=str, required=True,
+                   help='merged spike file.')
+    P.add_argument('-f', '--format', type=str, default='gdf', choices=['gdf', 'bin32', 'bin64'],
+                   help='format of the input files (default gdf).')
+    P.add_argument('--output-format', type=str, default=None, choices=['gdf', 'bin32', 'bin64'],
+                   help='format of the output file (default: same as the input).')
+    P.add_argument('--presorted', action='store_true',
+                   help='each input file is already sorted by time.')
+
+    return P.parse_args()
+
+# Binary records are (gid: uint32, time: float32 or float64), little-endian.
+record_struct = {'bin32': struct.Struct('<If'), 'bin64': struct.Struct('<Id')}
+
+# Yield the spikes in a file as (time, gid) tuples.
+def read_spikes(fname, fmt):
+    if fmt=='gdf':
+        with open(fname) as f:
+            for line in f:
+                fields = line.split()
+                if len(fields)==2:
+                    yield (float(fields[1]), int(fields[0]))
+    else:
+        rec = record_struct[fmt]
+        with open(fname, 'rb') as f:
+            while True:
+                chunk = f.read(rec.size*65536)
+                if not chunk:
+                    break
+                for gid, time in rec.iter_unpack(chunk):
+                    yield (time, gid)
+
+def write_spikes(fname, fmt, spikes):
+    n = 0
+    if fmt=='gdf':
+        with open(fname, 'w') as f:
+            for time, gid in spikes:
+                f.write('%u %.4f\n'%(gid, time))
+                n += 1
+    else:
+        rec = record_struct[fmt]
+        with open(fname, 'wb') as f:
+            for time, gid in spikes:
+                f.write(rec.pack(gid, time))
+                n += 1
+    return n
+
+args = parse_clargs()
+ofmt = args.output_format or args.format
+
+streams = [read_spikes(fname, args.format) for fname in args.inputs]
+if args.presorted:
+    spikes = heapq.merge(*streams)
+else:
+    # Sort by time, with ties broken by gid.
+    spikes = sorted(s for stream in streams for s in stream)
+
+n = write_spikes(args.output, ofmt, spikes)
+print('merged %d spikes from %d files into %s'%(n, len(args.inputs), args.output))
@@ -0,0 +1,65 @@
+import math
+import random
+
+# Connectivity families for the random connections of each cell, in addition to
+# the connection from the previous cell in its ring. These follow the families of
+# the Arbor engine (see arbor/connectivity.hpp), with a random number generator
+# seeded on the gid of each cell, so the networks are statistically, but not
+# exactly, the same as Arbor's.
+
+# The number of random connections onto a cell, when the mean is count.
+# For the power law family it is drawn from a Pareto distribution with the lower
+# bound chosen so that the mean is count, and capped at 100 times the mean.
+def num_random_connections(rng, count, params):
+    if params.kind!='powerlaw' or count==0:
+        return count
+    a = params.exponent
+    kmin = count*(a-2)/(a-1)
+    k = kmin*(1-rng.random())**(-1/(a-1))
+    return int(min(max(k, 1), 100*count))
+
+# The source gid and delay of random connection i>0 of cell gid.
+def random_connection(rng, gid, i, num_cells, min_delay, params):
+    n = num_cells
+    delay = min_delay + rng.uniform(0, 2*min_delay)
+
+    if params.kind=='smallworld':
+        # Watts-Strogatz: connection i is from the gid at offset -1, +1, -2, +2, ...
+        # on a ring lattice of all cells, unless it is rewired to a random source.
+        if rng.random()<params.rewire:
+            src = rng.randint(0, n-2)
+            if src>=gid:
+                src += 1
+        else:
+            m = (i+1)//2
+            src = (gid + (-m if i%2 else m))%n
+    elif params.kind=='distance':
+        # Cells on a grid of width ceil(sqrt(n)) with periodic boundaries, with a
+        # Gaussian offset of the source and a delay that grows with its length.
+        w = int(math.ceil(math.sqrt(n)))
+        h = (n+w-1)//w
+        dx = int(round(rng.gauss(0, params.sigma)))
+        dy = int(round(rng.gauss(0, params.sigma)))
+        if dx==0 and dy==0:
+            dx = rng.choice([-1, 1])
+        src = ((gid//w + dy)%h)*w + (gid%w + dx)%w
+        # The last row of the grid may be incomplete.
+        if src>=n:
+            src -= w
+        delay = min_delay + params.delay_per_unit*math.hypot(dx, dy)
+    else:
+        src = rng.randint(0, n-2)
+        if src>=gid:
+            src += 1
+
+    src %= n
+    if src==gid:
+        src = (src+1)%n
+    return src, delay
+
+# The sources and delays of the random connections of cell gid,
+# when the mean number of random connections is count.
+def random_connections(gid, count, num_cells, min_delay, params):
+    rng = random.Random(gid)
+    nrandom = num_random_connections(rng, count, params)
+    return [random_connection(rng, gid, i, num_cells, min_delay, params) for i in range(1, nrandom+1)]
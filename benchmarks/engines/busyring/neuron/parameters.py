@@ -35,6 +35,22 @@ class cell_parameters:
             self.lengths      = [200, 20]
             self.synapses     = 1
 
+# The connectivity of the random connections of each cell, see connectivity.py.
+# These parameters are optional, and default to uniformly random sources.
+class connectivity_parameters:
+    def __repr__(self):
+        return "  connectivity :  {0:>10s}\n".format(self.kind)
+
+    def __init__(self, data=None):
+        data = data or {}
+        self.kind           = data.get('connectivity', 'random')
+        self.rewire         = data.get('rewire-prob', 0.1)
+        self.sigma          = data.get('distance-sigma', 4)
+        self.delay_per_unit = data.get('distance-delay', 0.5)
+        self.exponent       = data.get('powerlaw-exponent', 2.5)
+        if self.kind not in ['random', 'smallworld', 'distance', 'powerlaw']:
+            raise Exception(str('unknown connectivity "'+ self.kind+ '"'))
+
 class model_parameters:
     def __repr__(self):
         s = "parameters\n" \
@@ -46,6 +62,7 @@ class model_parameters:
             "  dt           : {5:10.0f} ms\n" \
             .format(self.name, self.num_cells, self.ring_size, self.duration, self.min_delay, self.dt)
         s+= str(self.cell)
+        s+= str(self.connectivity)
         return s
 
     def __init__(self, filename=None):
@@ -56,6 +73,7 @@ class model_parameters:
         self.min_delay = 10
         self.ring_size = 10
         self.cell = cell_parameters()
+        self.connectivity = connectivity_parameters()
 
         if filename:
             with open(filename) as f:
@@ -67,4 +85,5 @@ class model_parameters:
                 self.dt        = from_json(data, 'dt')
                 self.min_delay = from_json(data, 'min-delay')
                 self.cell      = cell_parameters(data)
+                self.connectivity = connectivity_parameters(data)
 
@@ -15,6 +15,7 @@ from neuron import h
 
 import metering
 import cell
+import connectivity
 import parameters
 import neuron_tools as nrn
 
@@ -99,16 +100,28 @@ class ring_network:
                 self.stims.append(stim)
                 self.stim_connections.append(stim_connection)
 
-            # generate dummy connections with random source and zero weights.
-            for sid in range(1, self.synapses_per_cell):
-                src = random.randint(0, self.num_cells-2)
-                if src==gid:
-                    src=src+1
-                delay = params.min_delay + random.uniform(0, 2*params.min_delay)
-                con = self.pc.gid_connect(src, self.cells[i].synapses[sid])
-                con.weight[0] = 0
-                con.delay = delay
-                self.connections.append(con)
+            if params.connectivity.kind!='random':
+                # connections of the other connectivities, with zero weights,
+                # spread over the synapses other than the ring synapse.
+                nsyn = self.synapses_per_cell
+                sources = connectivity.random_connections(gid, nsyn-1, self.num_cells, params.min_delay, params.connectivity)
+                for j, (src, delay) in enumerate(sources):
+                    sid = 1 + j%(nsyn-1) if nsyn>1 else 0
+                    con = self.pc.gid_connect(src, self.cells[i].synapses[sid])
+                    con.weight[0] = 0
+                    con.delay = delay
+                    self.connections.append(con)
+            else:
+                # generate dummy connections with random source and zero weights.
+                for sid in range(1, self.synapses_per_cell):
+                    src = random.randint(0, self.num_cells-2)
+                    if src==gid:
+                        src=src+1
+                    delay = params.min_delay + random.uniform(0, 2*params.min_delay)
+                    con = self.pc.gid_connect(src, self.cells[i].synapses[sid])
+                    con.weight[0] = 0
+                    con.delay = delay
+                    self.connections.append(con)
 
 # hoc setup
 nrn.hoc_setup()
@@ -0,0 +1,312 @@
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include <arbor/common_types.hpp>
+#include <arbor/context.hpp>
+#include <arbor/lif_cell.hpp>
+#include <arbor/load_balance.hpp>
+#include <arbor/profile/meter_manager.hpp>
+#include <arbor/recipe.hpp>
+#include <arbor/simulation.hpp>
+#include <arbor/spike.hpp>
+#include <arbor/version.hpp>
+
+#include <arborenv/default_env.hpp>
+
+#include "affinity.hpp"
+#include "chrome_trace.hpp"
+#include "connectivity.hpp"
+#include "decomposition.hpp"
+#include "epoch_series.hpp"
+#include "firing.hpp"
+#include "parameters.hpp"
+#include "rng.hpp"
+#include "run_report.hpp"
+
+#ifdef ARB_MPI_ENABLED
+#include <mpi.h>
+#include <arborenv/with_mpi.hpp>
+#endif
+
+using arb::cell_gid_type;
+using arb::cell_size_type;
+using arb::cell_kind;
+using arb::time_type;
+
+// The busyring network with LIF cells instead of cable cells, so that the cost of
+// a simulation is dominated by spike exchange and event delivery instead of cell
+// updates. Each cell is driven to fire on its firing schedule by an event
+// generator with a weight that is far above threshold, and the connections of
+// busyring carry spikes without changing the activity.
+class exchange_recipe: public arb::recipe {
+public:
+    exchange_recipe(exchange_params params): params_(std::move(params)) {}
+
+    cell_size_type num_cells() const override { return params_.model.num_cells; }
+    cell_kind get_cell_kind(cell_gid_type gid) const override { return cell_kind::lif; }
+    arb::util::unique_any get_cell_description(cell_gid_type gid) const override {
+        arb::lif_cell cell("detector", "p_syn");
+        cell.t_ref = 0.1;
+        return cell;
+    }
+
+    std::vector<arb::cell_connection> connections_on(cell_gid_type gid) const override {
+        return ring_connections(gid, params_.model, 0);
+    }
+
+    std::vector<arb::event_generator> event_generators(cell_gid_type gid) const override {
+        // Seed the schedule of each cell from its own random stream.
+        auto r = rng::block(gid, rng::background, 0);
+        const double rate = params_.firing.rate/1000; // [kHz]
+        if (params_.firing.schedule==schedule_kind::regular) {
+            const double period = 1/rate;
+            return {arb::regular_generator({"p_syn"}, drive_weight_, period*rng::uniform01(r[2]), period)};
+        }
+        std::mt19937_64 gen((std::uint64_t(r[0])<<32)|r[1]);
+        return {arb::poisson_generator({"p_syn"}, drive_weight_, 0, rate, gen)};
+    }
+
+private:
+    exchange_params params_;
+
+    // Weight of the driving events: a LIF cell with the default parameters fires
+    // for any event with weight above C_m*V_th = 200.
+    float drive_weight_ = 1000;
+};
+
+// Statistics of spike exchange over the epochs of a run.
+struct exchange_stats {
+    unsigned ranks = 1;
+    std::size_t epochs = 0;
+    double time_mean = 0;               // Mean over epochs of the wall time of the slowest rank [s].
+    double time_max = 0;                // Longest wall time of any epoch on any rank [s].
+    double spikes_mean = 0;             // Mean number of spikes exchanged per epoch.
+    std::uint64_t spikes_max = 0;       // Largest number of spikes exchanged in an epoch.
+    double bytes_mean = 0;              // Mean bytes gathered by each rank per epoch.
+    double spikes_per_second = 0;       // Spikes exchanged per second of wall time.
+
+    // Collective: the statistics are valid on the root rank.
+    exchange_stats(const epoch_series& rec, double run_time, const arb::context& ctx): ranks(arb::num_ranks(ctx)) {
+        const auto s = rec.reduce(ctx);
+        epochs = s.size();
+
+        // The epoch times of the slowest rank, which all the other ranks wait for,
+        // and the gathered spikes, which are the same on every rank.
+        const double total = std::accumulate(s.spikes.begin(), s.spikes.end(), 0.);
+        if (epochs) {
+            time_mean = std::accumulate(s.wall_max.begin(), s.wall_max.end(), 0.)/epochs;
+            time_max = *std::max_element(s.wall_max.begin(), s.wall_max.end());
+            spikes_mean = total/epochs;
+            spikes_max = *std::max_element(s.spikes.begin(), s.spikes.end());
+        }
+        bytes_mean = spikes_mean*sizeof(arb::spike);
+        spikes_per_second = run_time>0? total/run_time: 0;
+    }
+
+    nlohmann::json to_json() const {
+        return {
+            {"epochs", epochs},
+            {"epoch-time", {{"mean", time_mean}, {"max", time_max}}},
+            {"spikes-per-epoch", {{"mean", spikes_mean}, {"max", spikes_max}}},
+            {"bytes-per-epoch", bytes_mean},
+            {"spikes-per-second", spikes_per_second}
+        };
+    }
+
+    friend std::ostream& operator<<(std::ostream& o, const exchange_stats& s) {
+        return o << "exchange: " << s.ranks << " ranks; " << s.epochs << " epochs; "
+                 << "epoch-time mean " << s.time_mean << " max " << s.time_max << " s; "
+                 << "spikes-per-epoch mean " << s.spikes_mean << " max " << s.spikes_max << "; "
+                 << "bytes-per-epoch " << s.bytes_mean << "; "
+                 << "spikes-per-second " << s.spikes_per_second;
+    }
+};
+
+// The benchmark report in json format, with the fields of the busyring report
+// (schema version 1) that apply to LIF cells, and the exchange statistics.
+nlohmann::json json_report(const exchange_params& params, const arb::context& context, const arb::profile::meter_report& report,
+                           std::uint64_t num_spikes, const run_stats& times, const exchange_stats& stats)
+{
+    auto& p = params.model;
+
+    nlohmann::json j;
+    j["schema-version"] = 1;
+    j["name"] = p.name;
+    j["benchmark"] = "exchange";
+    j["simulator"] = "arbor";
+    j["resources"] = {
+        {"ranks", num_ranks(context)},
+        {"threads", num_threads(context)},
+        {"gpu", false},
+        {"mpi", has_mpi(context)}
+    };
+    j["model"] = {
+        {"cells", p.num_cells},
+        {"compartments", 0},
+        {"connections-per-cell", p.cell.synapses},
+        {"connectivity", connectivity_name(p.connectivity.kind)},
+        {"firing-rate", params.firing.rate},
+        {"duration", p.duration},
+        {"dt", p.dt}
+    };
+    j["spikes"] = num_spikes;
+    add_meters(j, report);
+    j["run-time"] = times.to_json();
+    j["exchange"] = stats.to_json();
+    return j;
+}
+
+void run_model(const exchange_params& params, const arb::context& context) {
+    auto& p = params.model;
+    const bool root = arb::rank(context)==0;
+
+    if (root) {
+        std::cout << "threads:  " << num_threads(context) << "\n";
+        std::cout << "mpi:      " << (has_mpi(context)? "yes": "no") << "\n";
+        std::cout << "ranks:    " << num_ranks(context) << "\n";
+    }
+
+    auto affinity = gather_affinity(context);
+    if (root) {
+        print_affinity(std::cout, affinity);
+        std::cout << std::endl;
+    }
+
+    arb::profile::meter_manager meters;
+    std::optional<chrome_trace> trace;
+    if (p.trace_out) trace.emplace();
+    meters.start(context);
+    if (trace) trace->start();
+
+    auto checkpoint = [&](const char* name) {
+        meters.checkpoint(name, context);
+        if (trace) trace->checkpoint(name);
+    };
+
+    exchange_recipe recipe(params);
+    checkpoint("model-init");
+    if (root) {
+        std::cout << "cell stats: " << p.num_cells << " cells; 0 branches; 0 compartments; \n";
+        std::cout << "firing: " << (params.firing.schedule==schedule_kind::regular? "regular": "poisson")
+                  << " " << params.firing.rate << " Hz; connectivity " << connectivity_name(p.connectivity.kind)
+                  << "; " << p.cell.synapses << " connections per cell\n";
+    }
+
+    arb::partition_hint hint;
+    hint.cpu_group_size = p.partition.cpu_group_size;
+    auto decomp = p.partition.kind==decomposition_kind::ring?
+        partition_by_ring(recipe, context, p.ring_size, p.partition, cell_kind::lif):
+        arb::partition_load_balance(recipe, context, {{cell_kind::lif, hint}});
+    checkpoint("model-decompose");
+
+    arb::simulation sim(recipe, context, decomp);
+    checkpoint("model-build");
+
+    if (root) std::cout << "running simulation" << std::endl;
+    std::vector<double> run_times;
+    std::unique_ptr<epoch_series> epochs;
+    const unsigned nruns = p.warmup+p.repetitions;
+    for (unsigned i=0; i<nruns; ++i) {
+        if (i>0) sim.reset();
+
+        // Record the wall time and the spikes exchanged in each epoch of the run.
+        epochs = std::make_unique<epoch_series>(epoch_series::expected_epochs(p.duration, p.min_delay));
+        epochs->attach(sim);
+        sim.set_global_spike_callback(
+            [e=epochs.get()](const std::vector<arb::spike>& spikes) { e->exchange(spikes.size(), 0); });
+#ifdef ARB_MPI_ENABLED
+        MPI_Barrier(MPI_COMM_WORLD);
+#endif
+        epochs->start();
+        auto t0 = std::chrono::steady_clock::now();
+        sim.run(p.duration, p.dt);
+#ifdef ARB_MPI_ENABLED
+        MPI_Barrier(MPI_COMM_WORLD);
+#endif
+        auto t1 = std::chrono::steady_clock::now();
+
+        if (i+1==p.warmup) checkpoint("model-warmup");
+        if (i>=p.warmup) run_times.push_back(std::chrono::duration<double>(t1-t0).count());
+    }
+    checkpoint("model-run");
+
+    // The exchange statistics are those of the last run.
+    exchange_stats stats(*epochs, run_times.back(), context);
+    auto ns = sim.num_spikes();
+
+    auto report = arb::profile::make_meter_report(meters, context);
+    if (trace) trace->write(p.odir + "/" + p.name + "_trace.json", context);
+    if (root) {
+        std::cout << "\n" << ns << " spikes generated at rate of "
+                  << p.duration/ns << " ms between spikes\n";
+        std::cout << report;
+    }
+
+    // Statistics of the time taken by each timed repetition of sim.run().
+    run_stats times(run_times);
+    if (root) {
+        if (p.repetitions>1 || p.warmup>0) std::cout << times << "\n";
+        std::cout << stats << "\n";
+    }
+
+    // Computed after the last checkpoint, so that it isn't part of any phase.
+    if (p.cross_rank_stats) {
+        cross_rank_connections cross_rank(recipe, decomp);
+        if (root) std::cout << "cross-rank connections: " << cross_rank << "\n";
+    }
+
+    if (root && p.report==report_format::json) {
+        std::ofstream fid(p.odir + "/" + p.name + "_report.json");
+        fid << std::setw(1) << json_report(params, context, report, ns, times, stats) << "\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    try {
+        bool root = true;
+
+        auto runs = read_exchange_options(argc, argv);
+
+        // All runs share the context, and so the binding of the first run.
+        const auto binding = runs.front().model.binding;
+
+        arb::proc_allocation resources;
+        resources.num_threads = arbenv::default_concurrency();
+        resources.bind_threads = binding.bind_threads;
+        resources.bind_procs = binding.bind_procs;
+
+#ifdef ARB_MPI_ENABLED
+        arbenv::with_mpi guard(argc, argv, false);
+        bind_ranks_to_numa(binding.ranks_per_numa);
+        auto context = arb::make_context(resources, MPI_COMM_WORLD);
+        root = arb::rank(context) == 0;
+#else
+        bind_ranks_to_numa(binding.ranks_per_numa);
+        auto context = arb::make_context(resources);
+#endif
+
+        for (auto& params: runs) {
+            if (root) {
+                std::cout << "run: " << params.model.name << "\n";
+            }
+            run_model(params, context);
+        }
+    }
+    catch (std::exception& e) {
+        std::cerr << "exception caught in exchange miniapp: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
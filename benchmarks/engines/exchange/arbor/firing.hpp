@@ -0,0 +1,97 @@
+#pragma once
+
+#include <string>
+#include <utility>
+
+#include <nlohmann/json.hpp>
+
+#include <common/json_params.hpp>
+
+#include "parameters.hpp"
+
+// How the firing times of each cell are generated.
+enum class schedule_kind {
+    regular,    // Regular firing, with a random phase for each cell.
+    poisson     // Poisson firing.
+};
+
+// The schedule on which every cell fires.
+struct firing_parameters {
+    schedule_kind schedule = schedule_kind::poisson;
+    double rate = 10;                   // Firing rate of each cell [Hz].
+};
+
+// The parameters of the spike exchange benchmark: the network, run and report
+// parameters of busyring, which determine the connectivity with ring_connections,
+// and the firing schedule of the cells.
+struct exchange_params {
+    ring_params model;
+    firing_parameters firing;
+};
+
+exchange_params exchange_params_from_json(nlohmann::json json) {
+    using sup::param_from_json;
+
+    exchange_params params;
+
+    enum_from_json(params.firing.schedule, "firing-schedule",
+            {{"regular", schedule_kind::regular}, {"poisson", schedule_kind::poisson}}, json);
+    param_from_json(params.firing.rate, "firing-rate", json);
+    if (params.firing.rate<=0) {
+        throw std::runtime_error("firing-rate must be positive.");
+    }
+
+    // The busyring parameters of the cable cells, their inputs and outputs, and of
+    // the options that are only implemented by busyring, which would otherwise be
+    // read and then silently ignored.
+    for (auto key: {"rebuild", "gpu-group-size", "prefer-gpu", "background-rate", "background-weight",
+                    "background-targets", "perf-counters", "epoch-series", "spike-exchange", "dry-run-ranks",
+                    "record", "trace-format", "sample-selection", "sample-stride", "sample-fraction",
+                    "sample-gids", "sample-interval", "complex", "depth", "branch-probs", "compartments",
+                    "lengths", "prototype-cache", "unique-morphologies", "spike-output", "spike-gather",
+                    "spike-sort", "spike-buffer"})
+    {
+        if (json.find(key)!=json.end()) {
+            throw std::runtime_error(std::string(key)+" is not supported by the exchange benchmark.");
+        }
+    }
+
+    params.model = params_from_json(std::move(json));
+    if (params.model.partition.kind==decomposition_kind::weighted) {
+        throw std::runtime_error("decomposition \"weighted\" is not supported: all cells have the same cost.");
+    }
+    // LIF cells only run on the CPU.
+    params.model.partition.prefer_gpu = false;
+
+    return params;
+}
+
+// Read the configurations of the runs from the command line.
+std::vector<exchange_params> read_exchange_options(int argc, char** argv) {
+    const char* usage = "Usage:  arbor-exchange [--report=text|json] [--trace-out] [--bind-threads] [--bind-procs]\n"
+                        "                       [--ranks-per-numa=N] [params [opath]]\n\n"
+                        "Driver for the Arbor spike exchange benchmark\n\n"
+                        "Options:\n"
+                        "   --report: also write a json report to opath/<name>_report.json.\n"
+                        "   --trace-out: write a Chrome trace of the phases to opath/<name>_trace.json.\n"
+                        "   --bind-threads: bind each thread to a core.\n"
+                        "   --bind-procs: bind each rank to a disjoint set of cores.\n"
+                        "   --ranks-per-numa: bind N consecutive ranks on each host to each NUMA node.\n"
+                        "   params: JSON file with model parameters, or a list of them.\n"
+                        "   opath: output path.\n";
+
+    auto cl = read_command_line(argc, argv, usage);
+
+    std::vector<exchange_params> runs;
+    for (auto& c: cl.configs) {
+        runs.push_back(exchange_params_from_json(std::move(c)));
+        runs.back().model.report = cl.report;
+        runs.back().model.trace_out = cl.trace_out;
+        cl.apply(runs.back().model.binding);
+        if (!cl.odir.empty()) {
+            runs.back().model.odir = cl.odir;
+        }
+    }
+
+    return runs;
+}
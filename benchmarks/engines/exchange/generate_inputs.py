@@ -0,0 +1,103 @@
+import json
+import argparse
+import os
+
+def parse_clargs():
+    P = argparse.ArgumentParser(description='Spike exchange benchmark.')
+    P.add_argument('-c', '--config', type=str, default='',
+                   help='file with configuration of the benchmark.')
+    P.add_argument('-i', '--idir', type=str, default='./input',
+                   help='path for the generated input files.')
+    P.add_argument('--odir-arbor', type=str, default='./output/arbor',
+                   help='path for output generated by arbor benchmarks.')
+    P.add_argument('--odir-neuron', type=str, default='./output/neuron',
+                   help='path for output generated by neuron benchmarks.')
+    P.add_argument('--odir-coreneuron', type=str, default='./output/coreneuron',
+                   help='path for output generated by coreneuron benchmarks.')
+    P.add_argument('-b', '--bdir', type=str, default='.',
+                   help='path of the benchmark engine.')
+    P.add_argument('-e', '--edir', type=str, default='.',
+                   help='the path with the environment configurations for the simulators.')
+    P.add_argument('-s', '--sdir', type=str, default='.',
+                   help='the path of the nsuite bash scripts.')
+
+    return P.parse_args()
+
+# parse command line args
+args = parse_clargs()
+
+# parse parameters from config file
+conf_dat = json.loads(open(args.config).read())
+synapses = conf_dat['synapses']         # connections per cell
+# The same benchmark will be run multiple times, with an increasing
+# number of cells in each run. The min-cells and max-cells parameters
+# describe the range of model sizes.
+cb = range(conf_dat['min-cells'], conf_dat['max-cells']+1)
+cell_range=[pow(2,x) for x in cb]
+duration=200                    # simulation duration (ms)
+# Optional engine parameters that are forwarded verbatim to the input
+# file of each run when they are set in the model configuration.
+optional_keys = ['firing-rate', 'firing-schedule', 'rng',
+                 'warmup', 'repetitions', 'cpu-group-size', 'decomposition',
+                 'source-locality', 'source-window', 'random-weight',
+                 'connectivity', 'rewire-prob', 'distance-sigma', 'distance-delay', 'powerlaw-exponent',
+                 'bind-threads', 'bind-procs', 'ranks-per-numa', 'cross-rank-stats']
+
+idir = args.idir
+odir_arb = args.odir_arbor
+
+for d in [idir, odir_arb, args.odir_neuron, args.odir_coreneuron]:
+    os.makedirs(d, exist_ok=True)
+
+envdir    = args.edir # path with environments for each simulation engine
+scriptdir = args.sdir # nsuite bash scripts
+
+# The exchange benchmark is only implemented for Arbor.
+for sim, script in [('NEURON', 'run_nrn.sh'), ('CoreNeuron', 'run_corenrn.sh')]:
+    with open('%s/%s'%(idir, script), 'w') as fid:
+        fid.write('echo "  the exchange benchmark is not implemented for %s"\n'%(sim))
+
+arb_run_fid = open('%s/run_arb.sh'%(idir), 'w')
+arb_run_fid.write('source "%s/env_arbor.sh"\n'%(envdir))
+arb_run_fid.write('source "%s/bench_output.sh"\n'%(scriptdir))
+arb_run_fid.write('odir="%s"\n'%(odir_arb))
+arb_run_fid.write('mkdir -p "$odir"\n')
+arb_run_fid.write('rm -f "$odir/*"\n')
+arb_run_fid.write('[[ ! $(type -P arbor-exchange) ]]  && echo "Arbor needs to be installed before running benchmark"      && exit\n')
+arb_run_fid.write('echo "  cells compartments    wall(s)  throughput  mem-tot(MB) mem-percell(MB)"\n')
+
+run_names = []
+for ncells in cell_range:
+    run_name = 'run_%d'%(ncells)
+    d = {
+        'name': run_name,
+        'num-cells': ncells,
+        'synapses': synapses,
+        'min-delay': 5,
+        'duration': duration,
+        'ring-size': 10,
+        'dt': 0.025,
+        }
+    for key in optional_keys:
+        if key in conf_dat:
+            d[key] = conf_dat[key]
+
+    fname = idir+'/'+run_name+'.json'
+    pfid = open(fname, 'w')
+    pfid.write(json.dumps(d, indent=4))
+    pfid.close()
+
+    arb_run_fid.write('arb_ofile="$odir/%s".out\n'%(run_name))
+    arb_run_fid.write('run_with_mpi arbor-exchange --report=json "%s" "$odir" > $arb_ofile\n'%(fname))
+    arb_run_fid.write('table_line $arb_ofile\n')
+    run_names.append(run_name)
+
+arb_run_fid.write('echo\n')
+arb_run_fid.write('echo "  cells  ranks  epochs epoch-mean(s)  epoch-max(s)   spikes/ep      bytes/ep      spikes/s"\n')
+for run_name in run_names:
+    arb_run_fid.write('exchange_line "$odir/%s".out\n'%(run_name))
+arb_run_fid.write('echo\n')
+
+arb_run_fid.write('%s/csv_bench.sh --path="$odir" --exchange\n'%(scriptdir))
+
+arb_run_fid.close()
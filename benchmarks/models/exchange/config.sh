@@ -0,0 +1 @@
+../../../benchmarks/engines/busyring/bench_config.sh
\ No newline at end of file
@@ -2,12 +2,52 @@
 # Utilities used for processing benchmark output
 #
 
+bench_script_path=$(dirname "${BASH_SOURCE[0]}")
+
+# The fields of the json report that arbor-busyring writes next to its output
+# with --report=json, see bench_report.py.
+report_fields() {
+    ${ns_python:-python3} "$bench_script_path/bench_report.py" "$@"
+}
+
+# Time to solution of an arbor benchmark: the median over repetitions if the
+# run was repeated, otherwise the time of the model-run meter.
+run_time() {
+    awk '$1=="model-run" {t=$2} $1=="model-run-stats" {for(i=2; i<NF; ++i) if($i=="median") m=$(i+1)} END {print m==""? t: m}' "$1"
+}
+
+# Save the cpus of each thread, printed by the arbor benchmarks as "affinity:" lines
+# in their banner, to <name>_affinity.txt next to the output.
+record_affinity() {
+    fid="$1"
+    if grep -q '^affinity:' "$fid"; then
+        grep '^affinity:' "$fid" > "${fid%.out}_affinity.txt"
+    fi
+}
+
 table_line() {
     fid="$1"
+    report="${fid%.out}_report.json"
+    [ -f "$fid" ] && record_affinity "$fid"
     if [ ! -f "$fid" ]; then
         echo "ERROR: the benchmark output file \"$fid\" does not exist."
+    elif [ -f "$report" ]; then
+        read ncell ncomp tts totalmem nranks nthreads hasgpu <<< $(report_fields "$report")
+        cell_rate=`echo "$ncell/$tts" | bc -l`
+
+        printf "%7d%12d%12.3f%12.1f" $ncell $ncomp $tts $cell_rate
+
+        if [ "$totalmem" != "-" ]
+        then
+            cellmem=`echo $totalmem/$ncell | bc -l`
+            printf "%12.3f%12.3f" $totalmem $cellmem
+        else
+            printf "%12s%12s" '-' '-'
+        fi
+
+        printf "\n"
     else
-        tts=`awk '/^model-run/ {print $2}' $fid`
+        tts=`run_time $fid`
         ncell=`awk '/^cell stats/ {print $3}' $fid`
         ncomp=`awk '/^cell stats/ {print $7}' $fid`
         cell_rate=`echo "$ncell/$tts" | bc -l`
@@ -30,6 +70,17 @@ table_line() {
     fi
 }
 
+# The spike exchange statistics of an arbor-exchange benchmark, from its json report.
+exchange_line() {
+    report="${1%.out}_report.json"
+    if [ ! -f "$report" ]; then
+        echo "ERROR: the benchmark report \"$report\" does not exist."
+    else
+        read ncell nranks nepochs epoch_time epoch_max spikes bytes rate <<< $(report_fields "$report" --exchange)
+        printf "%7d%7d%8d%14.3e%14.3e%12.1f%14.1f%14.4g\n" $ncell $nranks $nepochs $epoch_time $epoch_max $spikes $bytes $rate
+    fi
+}
+
 coreneuron_table_line() {
     fid="$1"
     if [ ! -f "$fid" ]; then
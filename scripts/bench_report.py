@@ -0,0 +1,86 @@
+import argparse
+import json
+import sys
+
+# Print the fields of a busyring json benchmark report (arbor-busyring --report=json)
+# used by bench_output.sh and csv_bench.sh, as one line of space separated values:
+#
+#   cells compartments walltime memory ranks threads gpu [peak-rank peak-node] [counters...]
+#
+# walltime is the median time of the timed runs in s, and memory is the total
+# allocated memory in MB summed over ranks. With --memory-hwm, peak-rank and
+# peak-node are the largest peak resident memory in MB of any rank and of any
+# host, over all phases. Values that are not in the report,
+# such as memory on systems without a memory meter, are printed as "-".
+#
+# With --exchange, the spike exchange statistics of an arbor-exchange report are
+# printed instead:
+#
+#   cells ranks epochs epoch-time epoch-time-max spikes-per-epoch bytes-per-epoch spikes-per-second
+#
+# and nothing is printed for reports without them, such as those of busyring.
+
+def parse_clargs():
+    P = argparse.ArgumentParser(description='Print the fields of a busyring benchmark report.')
+    P.add_argument('report', type=str,
+                   help='json report file.')
+    P.add_argument('--counters', type=str, nargs='*', default=[],
+                   help='hardware counters of the model-run phase to print.')
+    P.add_argument('--memory-hwm', action='store_true',
+                   help='print the peak resident memory of a rank and of a host.')
+    P.add_argument('--exchange', action='store_true',
+                   help='print the spike exchange statistics.')
+
+    return P.parse_args()
+
+def total_memory(report):
+    for meter in report['meters']:
+        if meter['name'] in ['memory-allocated', 'memory']:
+            total = sum(sum(ranks) for ranks in meter['measurements'])
+            return total*1e-6 if meter['units']=='B' else total
+    return None
+
+def peak_memory(report, key):
+    phases = report.get('memory-hwm', {}).get('phases', {}).values()
+    peaks = [p[key] for p in phases if p is not None]
+    return max(peaks)*1e-6 if peaks else None
+
+def field(x):
+    if x is None:
+        return '-'
+    if isinstance(x, bool):
+        return 'yes' if x else 'no'
+    return str(x)
+
+args = parse_clargs()
+with open(args.report) as f:
+    report = json.load(f)
+
+resources = report['resources']
+
+if args.exchange:
+    if 'exchange' not in report:
+        sys.exit(0)
+    ex = report['exchange']
+    fields = [report['model']['cells'],
+              resources['ranks'],
+              ex.get('epochs'),
+              ex.get('epoch-time', {}).get('mean'),
+              ex.get('epoch-time', {}).get('max'),
+              ex.get('spikes-per-epoch', {}).get('mean'),
+              ex.get('bytes-per-epoch'),
+              ex.get('spikes-per-second')]
+else:
+    counts = report.get('perf-counters', {}).get('model-run', {})
+    fields = [report['model']['cells'],
+              report['model']['compartments'],
+              report['run-time']['median'],
+              total_memory(report),
+              resources['ranks'],
+              resources['threads'],
+              resources['gpu']]
+    if args.memory_hwm:
+        fields += [peak_memory(report, 'rank-max'), peak_memory(report, 'node-max')]
+    fields += [counts.get(c) for c in args.counters]
+
+print(' '.join(field(x) for x in fields))
@@ -80,7 +80,7 @@ cd $ns_base_path
 # find the Arbor library that was built and installed above.
 export CMAKE_PREFIX_PATH="$ns_install_path"
 
-benchmarks="busyring"
+benchmarks="busyring exchange"
 
 for bench in $benchmarks
 do
@@ -1,17 +1,19 @@
 usage() {
     cat <<_end_
-Usage: csv-bench.sh --path=PATH [--coreneuron]
+Usage: csv-bench.sh --path=PATH [--coreneuron] [--exchange]
 
 Generate CSV file summarising a set of benchmark runs.
 
 Options:
     --path=PATH      Path containing the output
     --coreneuron     If the path contains CoreNeuron output.
+    --exchange       Also generate exchange.csv from arbor-exchange reports.
 _end_
     exit 1
 }
 
 parse_coreneuron=false
+parse_exchange=false
 path=
 
 while [ "$1" != "" ]
@@ -20,6 +22,9 @@ do
         --coreneuron )
             parse_coreneuron=true
             ;;
+        --exchange )
+            parse_exchange=true
+            ;;
         --path=* )
             path="${1#--path=}"
             ;;
@@ -46,11 +51,57 @@ then
     exit 1
 fi
 
+# Time to solution of an arbor benchmark: the median over repetitions if the
+# run was repeated, otherwise the time of the model-run meter.
+run_time() {
+    awk '$1=="model-run" {t=$2} $1=="model-run-stats" {for(i=2; i<NF; ++i) if($i=="median") m=$(i+1)} END {print m==""? t: m}' "$1"
+}
+
+# Generate the line from the json report that arbor-busyring writes next to its
+# output with --report=json, see bench_report.py.
+# Append the peak resident memory of a rank and of a host, or empty columns if
+# they are "-".
+peak_columns() {
+    for peak in "$@"
+    do
+        [[ "$peak" == "-" ]] && peak=
+        line="$line"$(printf ,%12s "$peak")
+    done
+}
+
+table_line_report() {
+    report="$1"
+
+    read ncell ncomp tts totalmem nranks nthreads hasgpu peakrank peaknode counts <<< \
+        $(${ns_python:-python3} "$(dirname "$0")/bench_report.py" "$report" --memory-hwm --counters $perf_counters)
+
+    line=$(printf %9d,%12.3f, $ncell $tts)
+    if [ "$totalmem" != "-" ]
+    then
+        line="$line"$(printf %12.3f, $totalmem)
+    else
+        line="$line"$(printf %12s, '')
+    fi
+    line="$line"$(printf %7d,%7d,%7s $nranks $nthreads $hasgpu)
+    peak_columns $peakrank $peaknode
+    for count in $counts
+    do
+        [[ "$count" == "-" ]] && count=
+        line="$line"$(printf ,%16s "$count")
+    done
+}
+
 table_line() {
     fid="$1"
     line=
 
-    tts=$(awk '/^model-run/ {print $2}' "$fid")
+    if [ -f "${fid%.out}_report.json" ]
+    then
+        table_line_report "${fid%.out}_report.json"
+        return
+    fi
+
+    tts=$(run_time "$fid")
     ncell=$(awk '/^cell stats/ {print $3}' "$fid")
 
     line=$(printf %9d,%12.3f, $ncell $tts)
@@ -69,6 +120,19 @@ table_line() {
     nthreads=$(awk '/^threads:/ {print $2}' "$fid")
     hasgpu=$(awk '/^gpu:/ {print $2}' "$fid")
     line="$line"$(printf %7d,%7d,%7s $nranks $nthreads $hasgpu)
+
+    # The largest peak resident memory of a rank and of a host over all phases,
+    # from the hwm- lines of arbor-busyring.
+    peak_columns $(awk '/^hwm-/ {for(i=3; i<=5; i+=2) if($i!="-" && $i>m[i]) m[i]=$i} END {print (3 in m)? m[3]: "-", (5 in m)? m[5]: "-"}' "$fid")
+
+    # Hardware counters of the model-run phase, summed over threads and ranks,
+    # if the benchmark was run with perf-counters.
+    for counter in $perf_counters
+    do
+        count=$(awk -v c=$counter '/^perf-counters / {for(i=2; i<=NF; ++i) if($i==c) j=i} /^perf-model-run / {print j? $j: "-"}' "$fid")
+        [[ "$count" == "-" ]] && count=
+        line="$line"$(printf ,%16s "$count")
+    done
 }
 
 # NOTE: this is very fragile and will almost certainly break from version to
@@ -92,8 +156,16 @@ table_line_cnr() {
     hasgpu="no"
 
     line=$(printf %9d,%12.3f,%12.3f,%7d,%7d,%7s $ncell $tts $totalmem $nranks $nthreads $hasgpu)
+    peak_columns - -
+    for counter in $perf_counters
+    do
+        line="$line"$(printf ,%16s '')
+    done
 }
 
+# Hardware counters reported by arbor-busyring with perf-counters.
+perf_counters="cycles instructions llc-misses branch-misses stalled-cycles"
+
 # Use tmp file to generate unsorted table.
 tmp="$path/tmp"
 results="$path/results.csv"
@@ -104,12 +176,36 @@ do
     [[ "$parse_coreneuron" == "true" ]]  && table_line_cnr $f
     echo "$line" >> "$tmp"
 done
-printf "%9s,%12s,%12s,%7s,%7s,%7s\n" \
-       "cells" "walltime" "memory" "ranks" "threads" "gpu" \
+printf "%9s,%12s,%12s,%7s,%7s,%7s,%12s,%12s" \
+       "cells" "walltime" "memory" "ranks" "threads" "gpu" "peak-rank" "peak-node" \
        > "$results"
+printf ",%16s" $perf_counters >> "$results"
+printf "\n" >> "$results"
 
 # Sorting in ascending order of the number of cells (the first column in the output).
 # The output does not have to be sorted; however sorting by the number of cells will usuall
 # match the natural order of scaling benchmarks.
 sort -n "$tmp" >> "$results"
 rm -f "$tmp"
+
+# The spike exchange statistics of each run of arbor-exchange.
+if [ "$parse_exchange" == "true" ]
+then
+    exchange="$path/exchange.csv"
+    for f in "$path"/*_report.json
+    do
+        [ -f "$f" ] || continue
+        # Reports of other benchmarks, without exchange statistics, print nothing.
+        line=$(${ns_python:-python3} "$(dirname "$0")/bench_report.py" "$f" --exchange)
+        [ -n "$line" ] || continue
+        read ncell nranks fields <<< "$line"
+        printf "%9d,%7d" $ncell $nranks >> "$tmp"
+        printf ",%16s" $fields >> "$tmp"
+        printf "\n" >> "$tmp"
+    done
+    printf "%9s,%7s" "cells" "ranks" > "$exchange"
+    printf ",%16s" epochs epoch-time epoch-time-max spikes-per-epoch bytes-per-epoch spikes-per-second >> "$exchange"
+    printf "\n" >> "$exchange"
+    sort -n "$tmp" >> "$exchange"
+    rm -f "$tmp"
+fi